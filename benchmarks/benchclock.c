@@ -0,0 +1,58 @@
+/* Monotonic clock for the benchmark harness (see benchmarks/harness.lua).
+ *
+ * The Lua standard library only has os.clock, which measures processor time, and os.time, which
+ * has a resolution of one second. This module reads CLOCK_MONOTONIC, and can also call a function
+ * in a loop between two readings of the clock, so the loop itself doesn't add Lua overhead.
+ * */
+
+/* clock_gettime is POSIX, and is hidden by -std=c99 unless we ask for it. */
+#define _POSIX_C_SOURCE 199309L
+
+#include <time.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+static lua_Integer now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (lua_Integer)ts.tv_sec * 1000000000 + (lua_Integer)ts.tv_nsec;
+}
+
+/* now() -> nanoseconds, since some unspecified point in the past */
+static int benchclock_now(lua_State *L)
+{
+    lua_pushinteger(L, now_ns());
+    return 1;
+}
+
+/* time(f, n) -> nanoseconds that it took to call f() n times */
+static int benchclock_time(lua_State *L)
+{
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    lua_Integer n = luaL_checkinteger(L, 2);
+    lua_settop(L, 1);
+
+    lua_Integer t0 = now_ns();
+    for (lua_Integer i = 0; i < n; i++) {
+        lua_pushvalue(L, 1);
+        lua_call(L, 0, 0);
+    }
+    lua_Integer t1 = now_ns();
+
+    lua_pushinteger(L, t1 - t0);
+    return 1;
+}
+
+static luaL_Reg benchclock_funcs[] = {
+    { "now", benchclock_now },
+    { "time", benchclock_time },
+    { NULL, NULL }
+};
+
+int luaopen_benchmarks_benchclock(lua_State *L)
+{
+    luaL_newlib(L, benchclock_funcs);
+    return 1;
+}
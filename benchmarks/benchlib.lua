@@ -6,11 +6,13 @@ benchlib.DEFAULT_LUA = "lua"
 
 -- @param lua_path:       Lua interpreter to use
 -- @param benchmark_path: Path to the benchmark file
+-- @param pallenec_flags: Optional flags for pallenec, such as "-O0". If present, the benchmark is
+--                        always recompiled, because it might have been compiled with other flags.
 --
 -- Compiles the benchmark program (if necessary) and then
 -- reeturns a command-line string that will run the benchmark
 -- when invoked (suitable for time, perf, etc)
-function benchlib.prepare_benchmark(lua_path, benchmark_path, extra_params)
+function benchlib.prepare_benchmark(lua_path, benchmark_path, extra_params, pallenec_flags)
 
     extra_params = extra_params or {}
 
@@ -30,9 +32,13 @@ function benchlib.prepare_benchmark(lua_path, benchmark_path, extra_params)
 
     if ext == "pln" or ext == "c" then
         local so_name = "benchmarks/" .. test_dir .. "/" .. basename .. ".so"
+        local make_flags = ""
+        if pallenec_flags then
+            make_flags = "--always-make PALLENEC_FLAGS=" .. util.shell_quote(pallenec_flags)
+        end
         assert(util.execute(string.format(
-            "make --quiet -f benchmarks/Makefile %s",
-            util.shell_quote(so_name))))
+            "make --quiet -f benchmarks/Makefile %s %s",
+            make_flags, util.shell_quote(so_name))))
     elseif ext == "lua" then
         local lua_name = "benchmarks/" .. test_dir .. "/" .. basename .. ".lua"
         assert(util.execute(string.format(
@@ -63,9 +69,10 @@ end
 --
 -- Different ways to measure the benchmark commands
 --
--- run: (cmd -> str)
+-- run: (cmd, path -> str)
 --      Given the command line for the script to benchmark, returns the raw
---      output of the measurement utility
+--      output of the measurement utility. The path of the benchmark file is
+--      optional, and only used by modes that show per-function information.
 --
 -- parse: (str -> table)
 --      Extracts information from the raw measurement output into a table of
@@ -163,6 +170,182 @@ benchlib.modes.perf = {
     end
 }
 
+benchlib.modes.kernel = {
+    -- Measure only the benchmark kernel, excluding the Lua startup and the setup of the inputs.
+    -- See benchmarks/harness.lua. Set PALLENE_BENCH_BATCH to time several calls at once.
+    run = function(bench_cmd)
+        assert(util.execute("make --quiet -f benchmarks/Makefile benchmarks/benchclock.so"))
+        local measure_cmd = string.format("env PALLENE_BENCH_KERNEL=1 %s", bench_cmd)
+        local ok, err, _, res = util.outputs_of_execute(measure_cmd)
+        assert(ok, err)
+        return res
+    end,
+
+    parse = function(res)
+        return {
+            ops       = string.match(res, "kernel: (%d+) ops"),
+            ns_per_op = string.match(res, "([0-9.]+) ns/op %(median%)"),
+            time      = string.match(res, "([0-9.]+) s\n"),
+        }
+    end,
+}
+
+--
+-- Cachegrind support
+--
+
+-- Names of the C functions generated for a Pallene file, such as function_03 or function_03_lua,
+-- mapped to the name and line of the Pallene function.
+local function pallene_symbol_map(pln_path)
+    local driver = require "pallene.driver"
+    local input = assert(util.get_file_contents(pln_path))
+    local module = driver.compile_internal(pln_path, input, "optimize", 2)
+    local names = {}
+    if module then
+        for f_id, func in ipairs(module.functions) do
+            local desc = func.name
+            if func.loc then
+                desc = desc .. " " .. func.loc:show_line()
+            end
+            names[string.format("function_%02d", f_id)] = desc
+            names[string.format("function_%02d_lua", f_id)] = desc .. " (Lua entry point)"
+        end
+    end
+    return names
+end
+
+-- Reads a cachegrind.out file. Returns the list of event names, the totals for each event, and the
+-- totals per function. Function names may be compressed, as in "fn=(3) name" and later "fn=(3)".
+local function parse_cachegrind_out(contents)
+    local events
+    local totals = {}
+    local by_fn = {} -- fn_name => { event => count }
+    local fn_names = {}
+    local current
+    for line in string.gmatch(contents, "[^\n]+") do
+        local key, value = string.match(line, "^(%w+):%s*(.*)$")
+        if key == "events" then
+            events = {}
+            for ev in string.gmatch(value, "%S+") do table.insert(events, ev) end
+        elseif key == "summary" then
+            local i = 0
+            for n in string.gmatch(value, "%d+") do
+                i = i + 1
+                totals[events[i]] = tonumber(n)
+            end
+        elseif string.sub(line, 1, 3) == "fn=" then
+            local id, name = string.match(line, "^fn=(%(%d+%))%s*(.*)$")
+            if id then
+                if name ~= "" then fn_names[id] = name end
+                name = fn_names[id]
+            else
+                name = string.sub(line, 4)
+            end
+            current = by_fn[name]
+            if not current then
+                current = {}
+                for _, ev in ipairs(events) do current[ev] = 0 end
+                by_fn[name] = current
+            end
+        elseif current and string.match(line, "^%d") then
+            local i = 0
+            for n in string.gmatch(line, "%d+") do
+                if i > 0 then
+                    local ev = events[i]
+                    current[ev] = current[ev] + tonumber(n)
+                end
+                i = i + 1
+            end
+        end
+    end
+    return events, totals, by_fn
+end
+
+local function sum_events(counts, names)
+    local n = 0
+    for _, name in ipairs(names) do
+        n = n + (counts[name] or 0)
+    end
+    return n
+end
+
+-- Turns the cachegrind output into the report that benchmarks/run shows, and that the parse
+-- function reads back. The miss rates are only estimates from cachegrind's cache simulation.
+function benchlib.cachegrind_report(contents, symbols, max_functions)
+    local _, totals, by_fn = parse_cachegrind_out(contents)
+    local D1 = { "D1mr", "D1mw" }
+    local LL = { "ILmr", "DLmr", "DLmw" }
+    local BM = { "Bcm", "Bim" }
+    local B  = { "Bc", "Bi" }
+
+    local lines = {}
+    table.insert(lines, string.format("%-20s %16d", "instructions", totals.Ir or 0))
+    table.insert(lines, string.format("%-20s %16d", "D1 misses", sum_events(totals, D1)))
+    table.insert(lines, string.format("%-20s %16d", "LL misses", sum_events(totals, LL)))
+    table.insert(lines, string.format("%-20s %16d", "branches", sum_events(totals, B)))
+    table.insert(lines, string.format("%-20s %16d", "branch mispredicts", sum_events(totals, BM)))
+    table.insert(lines, "")
+
+    local fns = {}
+    for name, counts in pairs(by_fn) do
+        table.insert(fns, { name = name, counts = counts })
+    end
+    table.sort(fns, function(a, b)
+        if a.counts.Ir ~= b.counts.Ir then return a.counts.Ir > b.counts.Ir end
+        return a.name < b.name
+    end)
+
+    table.insert(lines, string.format("%14s %12s %12s %12s  %s",
+        "Ir", "D1 misses", "LL misses", "mispredicts", "function"))
+    for i = 1, math.min(#fns, max_functions or 20) do
+        local fn = fns[i]
+        local name = fn.name
+        if symbols[name] then
+            name = name .. " [" .. symbols[name] .. "]"
+        end
+        table.insert(lines, string.format("%14d %12d %12d %12d  %s",
+            fn.counts.Ir or 0, sum_events(fn.counts, D1), sum_events(fn.counts, LL),
+            sum_events(fn.counts, BM), name))
+    end
+    table.insert(lines, "")
+    return table.concat(lines, "\n")
+end
+
+benchlib.modes.cachegrind = {
+    -- Count instructions, and estimate cache misses and branch mispredictions, using Valgrind's
+    -- cachegrind. This is much slower than running the benchmark natively, but the counts are
+    -- deterministic, so they can be compared across runs even on a noisy or shared machine.
+    -- Functions generated by pallenec are shown with the name and line of the Pallene function.
+    run = function(bench_cmd, bench_path)
+        local out_file = os.tmpname()
+        local measure_cmd = string.format(
+            "valgrind --tool=cachegrind --cache-sim=yes --branch-sim=yes " ..
+            "--cachegrind-out-file=%s -- %s",
+            util.shell_quote(out_file), bench_cmd)
+        local ok, err = util.outputs_of_execute(measure_cmd)
+        local contents = util.get_file_contents(out_file)
+        os.remove(out_file)
+        assert(ok, err)
+        assert(contents, "cachegrind did not produce an output file")
+
+        local symbols = {}
+        if bench_path and string.match(bench_path, "%.pln$") then
+            symbols = pallene_symbol_map(bench_path)
+        end
+        return benchlib.cachegrind_report(contents, symbols)
+    end,
+
+    parse = function(res)
+        return {
+            instructions       = string.match(res, "instructions *(%d+)"),
+            d1_misses          = string.match(res, "D1 misses *(%d+)"),
+            ll_misses          = string.match(res, "LL misses *(%d+)"),
+            branches           = string.match(res, "branches *(%d+)"),
+            branch_mispredicts = string.match(res, "branch mispredicts *(%d+)"),
+        }
+    end,
+}
+
 benchlib.MODE_NAMES = {}
 for name, _ in pairs(benchlib.modes) do
     table.insert(benchlib.MODE_NAMES, name)
@@ -171,6 +354,19 @@ table.sort(benchlib.MODE_NAMES)
 
 --
 -- For scripts that run lots of benchmarks from a same directoty
+--
+
+-- Names of all the benchmarks, that is, of the directories with a main.lua.
+function benchlib.benchmark_names()
+    local ok, err, out = util.outputs_of_execute("ls -d benchmarks/*/main.lua")
+    assert(ok, err)
+    local names = {}
+    for name in string.gmatch(out, "benchmarks/([^/\n]+)/main.lua") do
+        table.insert(names, name)
+    end
+    return names
+end
+
 --
 -- @param bench: benchmark directory name (ex.: matmul)
 -- @param impl:  benchmark name           (ex.: lua, luajit, pallene)
@@ -220,11 +416,36 @@ function benchlib.find_benchmark(bench, impl)
     return false, string.format("failed to find %s/%s", bench, impl)
 end
 
+--
+-- Runs the benchmark [warmup] times without measuring, and then [reps] times measuring the
+-- wall-clock time. Returns the list of times, in seconds. Uses chronos if it is installed, because
+-- it is much more precise than /usr/bin/time, unless a [mode_name] is given.
+--
+function benchlib.measure_times(bench_cmd, warmup, reps, mode_name)
+    if not mode_name then
+        mode_name = pcall(require, "chronos") and "chronos" or "time"
+    end
+    local mode = assert(benchlib.modes[mode_name])
+    local function run_once()
+        local data = mode.parse(mode.run(bench_cmd))
+        return assert(tonumber(data.time), "could not measure the running time")
+    end
+
+    for _ = 1, warmup do
+        run_once()
+    end
+    local times = {}
+    for i = 1, reps do
+        times[i] = run_once()
+    end
+    return times
+end
+
 function benchlib.run_with_impl_name(modename, bench, impl, extra_params)
     local mode = assert(benchlib.modes[modename])
     local lua_path, bench_path = assert(benchlib.find_benchmark(bench, impl))
     local cmd = benchlib.prepare_benchmark(lua_path, bench_path, extra_params)
-    local res  = mode.run(cmd)
+    local res  = mode.run(cmd, bench_path)
     local data = mode.parse(res)
     return data
 end
@@ -21,6 +21,7 @@
 --   32       trees of depth 20       check: 67108832
 --   long lived tree of depth 21      check: 4194303
 --
+local harness = require "benchmarks.harness"
 local binarytrees = require(arg[1])
 local N   = tonumber(arg[2]) or 0
 --local REP = tonumber(arg[3]) or 1
@@ -28,23 +29,24 @@ local N   = tonumber(arg[2]) or 0
 local mindepth = 4
 local maxdepth = math.max(mindepth + 2, N)
 
-do
-    local stretchdepth = maxdepth + 1
-    local stretchtree = binarytrees.BottomUpTree(stretchdepth)
-    print(string.format("stretch tree of depth %d\t check: %d",
-        stretchdepth, binarytrees.ItemCheck(stretchtree)))
-end
+harness.kernel(1, function()
+    do
+        local stretchdepth = maxdepth + 1
+        local stretchtree = binarytrees.BottomUpTree(stretchdepth)
+        print(string.format("stretch tree of depth %d\t check: %d",
+            stretchdepth, binarytrees.ItemCheck(stretchtree)))
+    end
 
-local longlivedtree = binarytrees.BottomUpTree(maxdepth)
+    local longlivedtree = binarytrees.BottomUpTree(maxdepth)
 
-for depth = mindepth, maxdepth, 2 do
-    local r = binarytrees.Stress(mindepth, maxdepth, depth)
-    local iterations = r[1]
-    local check      = r[2]
-    print(string.format("%d\t trees of depth %d\t check: %d",
-        iterations, depth, check))
-end
-
-print(string.format("long lived tree of depth %d\t check: %d",
-    maxdepth, binarytrees.ItemCheck(longlivedtree)))
+    for depth = mindepth, maxdepth, 2 do
+        local r = binarytrees.Stress(mindepth, maxdepth, depth)
+        local iterations = r[1]
+        local check      = r[2]
+        print(string.format("%d\t trees of depth %d\t check: %d",
+            iterations, depth, check))
+    end
 
+    print(string.format("long lived tree of depth %d\t check: %d",
+        maxdepth, binarytrees.ItemCheck(longlivedtree)))
+end)
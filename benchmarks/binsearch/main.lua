@@ -1,3 +1,4 @@
+local harness = require "benchmarks.harness"
 local bs = require(arg[1])
 local N    = tonumber(arg[2]) or 1000000
 local nrep = tonumber(arg[3]) or N
@@ -7,5 +8,8 @@ for x = 1, N do
     t[x] = x
 end
 
-local r = bs.test(t, nrep)
+local r
+harness.kernel(1, function()
+    r = bs.test(t, nrep)
+end)
 print(r)
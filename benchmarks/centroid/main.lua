@@ -1,3 +1,4 @@
+local harness = require "benchmarks.harness"
 local point = require(arg[1])
 local N     = tonumber(arg[2]) or 10000
 local nrep  = tonumber(arg[3]) or 50000
@@ -8,5 +9,8 @@ for i = 1, N do
     arr[i] = point.new(d, d)
 end
 
-local r = point.centroid(arr, nrep)
+local r
+harness.kernel(1, function()
+    r = point.centroid(arr, nrep)
+end)
 print(r[1], r[2])
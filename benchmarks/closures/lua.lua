@@ -0,0 +1,27 @@
+local m = {}
+
+
+
+function m.affine(a, b)
+    return function(x)
+        return a * x + b
+    end
+end
+
+function m.compose(f, g)
+    return function(x)
+        return f(g(x))
+    end
+end
+
+function m.iterate(fs, n, x0)
+    local nfs = #fs
+    local x = x0
+    for i = 1, n do
+        local f = fs[(i - 1) % nfs + 1]
+        x = f(x)
+    end
+    return x
+end
+
+return m
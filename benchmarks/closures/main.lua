@@ -0,0 +1,23 @@
+-- Calls through closures.
+--
+-- Every call in the kernel is a dynamic call (CallDyn) to a closure that reads its upvalues, and
+-- some of the closures call other closures in turn.
+
+local harness = require "benchmarks.harness"
+local closures = require(arg[1])
+local N   = tonumber(arg[2]) or 10000000
+local REP = tonumber(arg[3]) or 1
+
+local fs = {}
+for i = 1, 8 do
+    fs[i] = closures.affine(0.5 + i / 32, i / 8)
+end
+for i = 1, 8 do
+    fs[8 + i] = closures.compose(fs[i], fs[9 - i])
+end
+
+local x
+harness.kernel(REP, function()
+    x = closures.iterate(fs, N, 1.0)
+end)
+print(string.format("%.9f", x))
@@ -1,3 +1,4 @@
+local harness = require "benchmarks.harness"
 local life   = require(arg[1])
 local nsteps = tonumber(arg[2]) or 2000
 
@@ -22,9 +23,9 @@ for i = 1, 8 do
 end
 
 io.write("\027[2J")	-- ANSI clear screen
-for _ = 1, nsteps do
+harness.kernel(nsteps, function()
     life.step(N, M, curr_cells, next_cells)
     curr_cells, next_cells = next_cells, curr_cells
     io.write("\027[H") -- ANSI home cursor
     life.draw(N, M, curr_cells)
-end
+end)
@@ -0,0 +1,34 @@
+local m = {}
+
+function m.relax(xs, nsteps)
+    local n = #xs
+    for _ = 1, nsteps do
+        for i = 2, n - 1 do
+            local left = xs[i - 1]
+            local right = xs[i + 1]
+            xs[i] = (left + right) * 0.5
+        end
+    end
+
+    local total = 0.0
+    for i = 1, n do
+        total = total + (xs[i])
+    end
+    return total
+end
+
+function m.count_kinds(xs)
+    local nfloat = 0
+    local nother = 0
+    for i = 1, #xs do
+        local v = xs[i]
+        if type(v) == "number" then
+            nfloat = nfloat + 1
+        else
+            nother = nother + 1
+        end
+    end
+    return { nfloat, nother }
+end
+
+return m
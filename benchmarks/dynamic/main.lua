@@ -0,0 +1,24 @@
+-- Boxing and unboxing through "any".
+--
+-- The array has type {any}, so every read is a FromDyn, with a tag check, and every write is a
+-- ToDyn.
+
+local harness = require "benchmarks.harness"
+local dynamic = require(arg[1])
+local N     = tonumber(arg[2]) or 1000
+local nstep = tonumber(arg[3]) or 20000
+
+local xs = {}
+for i = 1, N do
+    xs[i] = (i % 7) * 1.0
+end
+xs[1] = 100.0
+xs[N] = -100.0
+
+local total
+harness.kernel(1, function()
+    total = dynamic.relax(xs, nstep)
+end)
+local kinds = dynamic.count_kinds(xs)
+print(string.format("%.6f", total))
+print(kinds[1], kinds[2])
@@ -19,11 +19,15 @@
 --    3968050
 --    Pfannkuchen(12) = 65
 
+local harness = require "benchmarks.harness"
 local fannkuch =  require(arg[1])
 local N   = tonumber(arg[2]) or 7 -- or 12
 --local REP = tonumber(arg[3]) or 1
 
-local ret = fannkuch.fannkuch(N)
+local ret
+harness.kernel(1, function()
+    ret = fannkuch.fannkuch(N)
+end)
 local checksum = ret[1]
 local flips    = ret[2]
 print(checksum)
@@ -11,6 +11,7 @@
 --  * Use linear search (actually faster than binary search in the tests)
 --  * Use // integer division
 
+local harness = require "benchmarks.harness"
 local fasta = require(arg[1])
 local N   = tonumber(arg[2]) or 100
 --local REP = tonumber(arg[3]) or 1
@@ -49,6 +50,8 @@ local HOMO_SAPIENS = {
     { 't', 0.3015094502008 },
 }
 
-fasta.repeat_fasta("ONE", "Homo sapiens alu", HUMAN_ALU, N*2)
-fasta.random_fasta('TWO', 'IUB ambiguity codes', IUB, N*3)
-fasta.random_fasta('THREE', 'Homo sapiens frequency', HOMO_SAPIENS, N*5)
+harness.kernel(1, function()
+    fasta.repeat_fasta("ONE", "Homo sapiens alu", HUMAN_ALU, N*2)
+    fasta.random_fasta('TWO', 'IUB ambiguity codes', IUB, N*3)
+    fasta.random_fasta('THREE', 'Homo sapiens frequency', HOMO_SAPIENS, N*5)
+end)
@@ -0,0 +1,65 @@
+-- In-process timing of the benchmark kernels.
+--
+-- The main.lua of a benchmark first sets up its inputs, and then passes the code that we actually
+-- want to measure (the kernel) to harness.kernel:
+--
+--     local A = make_matrix(N)
+--     local C
+--     harness.kernel(REP, function()
+--         C = matmul.matmul(A, A)
+--     end)
+--
+-- Normally this just calls the kernel REP times. With `benchmarks/run --mode=kernel`, it also
+-- measures how long those calls take, leaving out the interpreter startup, the require and the
+-- setup, and reports the time per call (ns/op) to stderr. The calls are timed in batches of
+-- PALLENE_BENCH_BATCH calls (default 1), to amortize the cost of reading the clock when the kernel
+-- is very fast. The clock is in the benchmarks/benchclock.c module; it is built for PUC Lua, so
+-- under LuaJIT we fall back to os.clock.
+--
+-- This file must remain compatible with LuaJIT.
+
+local harness = {}
+
+local enabled = os.getenv("PALLENE_BENCH_KERNEL")
+
+local time_calls -- (f, n) -> nanoseconds
+if enabled then
+    local ok, benchclock = pcall(require, "benchmarks.benchclock")
+    if ok then
+        time_calls = benchclock.time
+    else
+        time_calls = function(f, n)
+            local t0 = os.clock()
+            for _ = 1, n do f() end
+            return (os.clock() - t0) * 1e9
+        end
+    end
+end
+
+function harness.kernel(nrep, f)
+    nrep = math.floor(nrep)
+    if not enabled then
+        for _ = 1, nrep do f() end
+        return
+    end
+
+    local batch = math.max(1, math.floor(tonumber(os.getenv("PALLENE_BENCH_BATCH")) or 1))
+    local samples = {} -- ns/op of each batch
+    local total_ns = 0
+    local done = 0
+    while done < nrep do
+        local n = math.min(batch, nrep - done)
+        local ns = time_calls(f, n)
+        samples[#samples + 1] = ns / n
+        total_ns = total_ns + ns
+        done = done + n
+    end
+    table.sort(samples)
+
+    local median = samples[math.floor((#samples + 1) / 2)]
+    io.stderr:write(string.format(
+        "kernel: %d ops, %.1f ns/op (median), %.1f ns/op (min), %.6f s\n",
+        nrep, median or 0, samples[1] or 0, total_ns / 1e9))
+end
+
+return harness
@@ -9,9 +9,12 @@
 --  * The LuaJIT version needs to be separate, due to the lack of bitwise ops.
 --  * The output is in the Netpbm file format. Use an image viewer to view the picture.
 
+local harness = require "benchmarks.harness"
 local mandelbrot = require(arg[1])
 local N   = tonumber(arg[2]) or 100
 --local REP = tonumber(arg[3]) or 1
 
 io.write(string.format("P4\n%d %d\n", N, N))
-mandelbrot.mandelbrot(N)
+harness.kernel(1, function()
+    mandelbrot.mandelbrot(N)
+end)
@@ -1,3 +1,4 @@
+local harness = require "benchmarks.harness"
 local matmul = require(arg[1])
 local N   = tonumber(arg[2]) or 800
 local REP = tonumber(arg[3]) or math.max(1.0, 2 * (800/N)^3)
@@ -17,8 +18,8 @@ for i = 1, N do
 end
 
 local C
-for _ = 1, REP do
+harness.kernel(REP, function()
     C = matmul.matmul(A, A)
-end
+end)
 print("#C", #C, #C[1])
 print("C[1][1]", C[1][1])
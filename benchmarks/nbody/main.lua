@@ -1,3 +1,4 @@
+local harness = require "benchmarks.harness"
 local nbody = require(arg[1])
 local N   = tonumber(arg[2]) or 1000 -- or 50000000
 local REP = tonumber(arg[3]) or 1
@@ -69,7 +70,7 @@ local bodies = {
 
 nbody.offset_momentum(bodies)
 print(string.format("%0.9f", nbody.energy(bodies)))
-for _ = 1, REP do
+harness.kernel(REP, function()
     nbody.advance_multiple_steps(N, bodies, 0.01)
-end
+end)
 print(string.format("%0.9f", nbody.energy(bodies)))
@@ -6,6 +6,7 @@
 -- away many of the table allocations.
 --
 
+local harness = require "benchmarks.harness"
 local Complex = require(arg[1])
 local N       = tonumber(arg[2]) or 256
 
@@ -31,13 +32,15 @@ local dy = (ymax - ymin) / N
 io.write("P2\n")
 io.write(N, " ", N, " ", 255, "\n")
 
-for i = 1, N do
-    local x = xmin + (i - 1) * dx
-    for j = 1, N do
-        local y = ymin + (j - 1) * dy
-        if j > 1 then io.write(" ") end
-        io.write(level(x, y))
+harness.kernel(1, function()
+    for i = 1, N do
+        local x = xmin + (i - 1) * dx
+        for j = 1, N do
+            local y = ymin + (j - 1) * dy
+            if j > 1 then io.write(" ") end
+            io.write(level(x, y))
+        end
+        io.write("\n")
     end
-    io.write("\n")
-end
+end)
 
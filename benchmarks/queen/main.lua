@@ -1,4 +1,7 @@
+local harness = require "benchmarks.harness"
 local nqueens = require(arg[1])
 local N       = tonumber(arg[2]) or 13
 
-nqueens.nqueens(N)
+harness.kernel(1, function()
+    nqueens.nqueens(N)
+end)
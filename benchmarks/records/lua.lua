@@ -0,0 +1,42 @@
+local m = {}
+
+
+
+
+
+
+
+function m.new_account(name, balance)
+    return { name = name, balance = balance, history = {} }
+end
+
+function m.simulate(accounts, nsteps)
+    local n = #accounts
+    for step = 1, nsteps do
+        for i = 1, n do
+            local from = accounts[i]
+            local to = accounts[(i * 7 + step) % n + 1]
+            local amount = from.balance * 0.01 + #from.name
+            from.balance = from.balance - amount
+            to.balance = to.balance + amount
+            local h = to.history
+            h[#h + 1] = amount
+            if #h >= 16 then
+                to.history = {}
+            end
+        end
+    end
+
+    local total = 0.0
+    local largest = 0.0
+    for i = 1, n do
+        local b = accounts[i].balance
+        total = total + b
+        if b > largest then
+            largest = b
+        end
+    end
+    return { total, largest }
+end
+
+return m
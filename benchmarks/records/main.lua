@@ -0,0 +1,21 @@
+-- Records with GC fields.
+--
+-- Exercises GetField and SetField on records whose fields are strings and arrays, which need write
+-- barriers, and the allocation of new arrays that are stored in a record field.
+
+local harness = require "benchmarks.harness"
+local records = require(arg[1])
+local N     = tonumber(arg[2]) or 1000
+local nstep = tonumber(arg[3]) or 10000
+
+local accounts = {}
+for i = 1, N do
+    accounts[i] = records.new_account("account" .. i, 100.0 * (i % 10))
+end
+
+local r
+harness.kernel(1, function()
+    r = records.simulate(accounts, nstep)
+end)
+print(string.format("%.6f", r[1]))
+print(string.format("%.6f", r[2]))
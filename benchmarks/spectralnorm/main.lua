@@ -1,3 +1,4 @@
+local harness = require "benchmarks.harness"
 local spectralnorm = require(arg[1])
 local N   = tonumber(arg[2]) or 1000 -- or 5500
 --local REP = tonumber(arg[3]) or 1
@@ -19,5 +20,8 @@ local N   = tonumber(arg[2]) or 1000 -- or 5500
 -- Expected output (N = 5500):
 --    1.274224153
 
-local res = spectralnorm.Approximate(N)
+local res
+harness.kernel(1, function()
+    res = spectralnorm.Approximate(N)
+end)
 print(string.format("%0.9f", res))
@@ -0,0 +1,120 @@
+-- Robust statistics for benchmark measurements.
+--
+-- Running times are not normally distributed: they have a hard lower bound and a long tail of
+-- slow outliers, caused by other processes, frequency scaling and so on. That is why we summarize
+-- them with the median and the median absolute deviation (MAD) instead of the mean and the standard
+-- deviation, and why we compare two sets of measurements with a rank test (Mann-Whitney U), which
+-- doesn't assume any particular distribution.
+
+local statistics = {}
+
+local function sorted_copy(xs)
+    local ys = {}
+    for i, x in ipairs(xs) do ys[i] = x end
+    table.sort(ys)
+    return ys
+end
+
+local function median_of_sorted(ys)
+    local n = #ys
+    assert(n > 0, "empty sample")
+    if n % 2 == 1 then
+        return ys[(n + 1) // 2]
+    else
+        return (ys[n // 2] + ys[n // 2 + 1]) / 2
+    end
+end
+
+function statistics.median(xs)
+    return median_of_sorted(sorted_copy(xs))
+end
+
+-- Median absolute deviation from the median.
+function statistics.mad(xs)
+    local m = statistics.median(xs)
+    local deviations = {}
+    for i, x in ipairs(xs) do
+        deviations[i] = math.abs(x - m)
+    end
+    return statistics.median(deviations)
+end
+
+-- 95% confidence interval for the median, using order statistics. This is distribution-free, but
+-- with fewer than 6 samples the best we can say is that the median is between the min and the max.
+function statistics.median_ci(xs)
+    local ys = sorted_copy(xs)
+    local n = #ys
+    local half_width = 1.96 * math.sqrt(n) / 2
+    local lo = math.max(1, math.floor(n / 2 - half_width))
+    local hi = math.min(n, math.ceil(1 + n / 2 + half_width))
+    return ys[lo], ys[hi]
+end
+
+-- Error function, with the approximation 7.1.26 of Abramowitz and Stegun (error < 1.5e-7).
+local function erf(x)
+    local sign = (x < 0) and -1 or 1
+    x = math.abs(x)
+    local t = 1 / (1 + 0.3275911 * x)
+    local poly = t * (0.254829592 + t * (-0.284496736 + t * (1.421413741 +
+        t * (-1.453152027 + t * 1.061405429))))
+    return sign * (1 - poly * math.exp(-x * x))
+end
+
+local function normal_cdf(z)
+    return 0.5 * (1 + erf(z / math.sqrt(2)))
+end
+
+--
+-- Mann-Whitney U test: how likely is it that [xs] and [ys] come from the same distribution?
+-- Returns the two-sided p-value, using the normal approximation with a correction for ties. The
+-- approximation is reasonable when both samples have at least 8 or so elements.
+--
+function statistics.mann_whitney(xs, ys)
+    local n1, n2 = #xs, #ys
+    local all = {}
+    for _, x in ipairs(xs) do table.insert(all, { value = x, first = true }) end
+    for _, y in ipairs(ys) do table.insert(all, { value = y, first = false }) end
+    table.sort(all, function(a, b) return a.value < b.value end)
+
+    -- Assign ranks, averaging the ranks of tied values.
+    local rank_sum = 0
+    local tie_term = 0
+    local i = 1
+    while i <= #all do
+        local j = i
+        while j < #all and all[j + 1].value == all[i].value do
+            j = j + 1
+        end
+        local rank = (i + j) / 2
+        for k = i, j do
+            if all[k].first then rank_sum = rank_sum + rank end
+        end
+        local t = j - i + 1
+        tie_term = tie_term + (t * t * t - t)
+        i = j + 1
+    end
+
+    local u = rank_sum - n1 * (n1 + 1) / 2
+    local n = n1 + n2
+    local mean = n1 * n2 / 2
+    local variance = n1 * n2 / 12 * ((n + 1) - tie_term / (n * (n - 1)))
+    if variance <= 0 then
+        return 1.0
+    end
+    local z = (math.abs(u - mean) - 0.5) / math.sqrt(variance)
+    if z < 0 then z = 0 end
+    return 2 * (1 - normal_cdf(z))
+end
+
+-- Summary of a list of measurements, in the format that benchmarks/measure saves.
+function statistics.summarize(xs)
+    local lo, hi = statistics.median_ci(xs)
+    return {
+        median = statistics.median(xs),
+        mad = statistics.mad(xs),
+        ci_low = lo,
+        ci_high = hi,
+    }
+end
+
+return statistics
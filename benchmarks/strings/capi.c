@@ -0,0 +1,87 @@
+/* Implementation of the string formatting benchmark using the Lua C API.
+ * The numbers are converted with luaL_tolstring, which is what tostring uses.
+ * */
+
+#include <lua.h>
+#include <lauxlib.h>
+
+inline
+static void check_nargs(lua_State *L, int expected)
+{
+    int nargs = lua_gettop(L);
+    if (nargs != expected) {
+        luaL_error(L, "Expected %d arguments, got %d", expected, nargs);
+    }
+}
+
+inline
+static lua_Integer getinteger(lua_State *L, int slot)
+{
+    int isnum;
+    lua_Integer out = lua_tointegerx(L, slot, &isnum);
+    if (!isnum) { luaL_error(L, "impossible"); }
+    return out;
+}
+
+/* Pushes tostring(t[i]) */
+static void push_tostring(lua_State *L, int t, lua_Integer i)
+{
+    lua_geti(L, t, i);
+    luaL_tolstring(L, -1, NULL);
+    lua_remove(L, -2);
+}
+
+static int format_lines(lua_State *L)
+{
+    check_nargs(L, 2);
+    // 1 = ids
+    // 2 = values
+    // 3 = lines
+
+    lua_len(L, 1);
+    lua_Integer n = getinteger(L, -1);
+    lua_pop(L, 1);
+
+    lua_createtable(L, (int) n, 0);
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_pushliteral(L, "id=");
+        push_tostring(L, 1, i);
+        lua_pushliteral(L, " value=");
+        push_tostring(L, 2, i);
+        lua_pushliteral(L, ";");
+        lua_concat(L, 5);
+        lua_seti(L, 3, i);
+    }
+    return 1;
+}
+
+static int total_length(lua_State *L)
+{
+    check_nargs(L, 1);
+    // 1 = lines
+
+    lua_len(L, 1);
+    lua_Integer n = getinteger(L, -1);
+    lua_pop(L, 1);
+
+    lua_Integer total = 0;
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_geti(L, 1, i);
+        total += (lua_Integer) lua_rawlen(L, -1);
+        lua_pop(L, 1);
+    }
+    lua_pushinteger(L, total);
+    return 1;
+}
+
+static luaL_Reg capi_funcs[] = {
+    { "format_lines", format_lines },
+    { "total_length", total_length },
+    { NULL, NULL }
+};
+
+int luaopen_benchmarks_strings_capi(lua_State *L)
+{
+    luaL_newlib(L, capi_funcs);
+    return 1;
+}
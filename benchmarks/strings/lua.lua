@@ -0,0 +1,19 @@
+local m = {}
+
+function m.format_lines(ids, values)
+    local lines = {}
+    for i = 1, #ids do
+        lines[i] = "id=" .. tostring(ids[i]) .. " value=" .. tostring(values[i]) .. ";"
+    end
+    return lines
+end
+
+function m.total_length(lines)
+    local n = 0
+    for i = 1, #lines do
+        n = n + #lines[i]
+    end
+    return n
+end
+
+return m
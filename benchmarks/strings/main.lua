@@ -0,0 +1,24 @@
+-- String concatenation and tostring.
+--
+-- Each line is built with a single concatenation of five strings, two of which come from tostring
+-- of an integer and of a float.
+
+local harness = require "benchmarks.harness"
+local strings = require(arg[1])
+local N    = tonumber(arg[2]) or 1000
+local nrep = tonumber(arg[3]) or 1000
+
+local ids = {}
+local values = {}
+for i = 1, N do
+    ids[i] = i * 37
+    values[i] = i / 8
+end
+
+local lines
+harness.kernel(nrep, function()
+    lines = strings.format_lines(ids, values)
+end)
+print(lines[1])
+print(lines[N])
+print(strings.total_length(lines))
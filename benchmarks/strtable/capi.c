@@ -0,0 +1,129 @@
+/* Implementation of the particle simulation using the Lua C API, with the fields of the particles
+ * accessed by name, like the Pallene version does.
+ * */
+
+#include <lua.h>
+#include <lauxlib.h>
+
+inline
+static void check_nargs(lua_State *L, int expected)
+{
+    int nargs = lua_gettop(L);
+    if (nargs != expected) {
+        luaL_error(L, "Expected %d arguments, got %d", expected, nargs);
+    }
+}
+
+inline
+static lua_Integer getinteger(lua_State *L, int slot)
+{
+    int isnum;
+    lua_Integer out = lua_tointegerx(L, slot, &isnum);
+    if (!isnum) { luaL_error(L, "impossible"); }
+    return out;
+}
+
+inline
+static lua_Number getnumber(lua_State *L, int slot)
+{
+    int isnum;
+    lua_Number out = lua_tonumberx(L, slot, &isnum);
+    if (!isnum) { luaL_error(L, "impossible"); }
+    return out;
+}
+
+static lua_Number getfield_number(lua_State *L, int slot, const char *name)
+{
+    lua_getfield(L, slot, name);
+    lua_Number out = getnumber(L, -1);
+    lua_pop(L, 1);
+    return out;
+}
+
+static void setfield_number(lua_State *L, int slot, const char *name, lua_Number value)
+{
+    lua_pushnumber(L, value);
+    lua_setfield(L, slot, name);
+}
+
+static int new_particle(lua_State *L)
+{
+    check_nargs(L, 4);
+    // 1 = x
+    // 2 = y
+    // 3 = vx
+    // 4 = vy
+    // 5 = out
+
+    lua_createtable(L, 0, 4);
+    lua_pushvalue(L, 1);
+    lua_setfield(L, 5, "x");
+    lua_pushvalue(L, 2);
+    lua_setfield(L, 5, "y");
+    lua_pushvalue(L, 3);
+    lua_setfield(L, 5, "vx");
+    lua_pushvalue(L, 4);
+    lua_setfield(L, 5, "vy");
+    return 1;
+}
+
+static int simulate(lua_State *L)
+{
+    check_nargs(L, 3);
+    // 1 = particles
+    // 2 = nsteps
+    // 3 = dt
+    // 4 = p
+
+    lua_Integer nsteps = getinteger(L, 2);
+    lua_Number dt = getnumber(L, 3);
+
+    lua_len(L, 1);
+    lua_Integer n = getinteger(L, -1);
+    lua_pop(L, 1);
+
+    for (lua_Integer step = 1; step <= nsteps; step++) {
+        for (lua_Integer i = 1; i <= n; i++) {
+            lua_geti(L, 1, i);
+            lua_Number x = getfield_number(L, 4, "x") + getfield_number(L, 4, "vx") * dt;
+            lua_Number y = getfield_number(L, 4, "y") + getfield_number(L, 4, "vy") * dt;
+            if (x < 0.0 || x > 1.0) {
+                setfield_number(L, 4, "vx", -getfield_number(L, 4, "vx"));
+            }
+            if (y < 0.0 || y > 1.0) {
+                setfield_number(L, 4, "vy", -getfield_number(L, 4, "vy"));
+            }
+            setfield_number(L, 4, "x", x);
+            setfield_number(L, 4, "y", y);
+            lua_pop(L, 1);
+        }
+    }
+
+    lua_Number cx = 0.0;
+    lua_Number cy = 0.0;
+    for (lua_Integer i = 1; i <= n; i++) {
+        lua_geti(L, 1, i);
+        cx = cx + getfield_number(L, 4, "x");
+        cy = cy + getfield_number(L, 4, "y");
+        lua_pop(L, 1);
+    }
+
+    lua_createtable(L, 2, 0);
+    lua_pushnumber(L, cx / n);
+    lua_seti(L, -2, 1);
+    lua_pushnumber(L, cy / n);
+    lua_seti(L, -2, 2);
+    return 1;
+}
+
+static luaL_Reg capi_funcs[] = {
+    { "new_particle", new_particle },
+    { "simulate", simulate },
+    { NULL, NULL }
+};
+
+int luaopen_benchmarks_strtable_capi(lua_State *L)
+{
+    luaL_newlib(L, capi_funcs);
+    return 1;
+}
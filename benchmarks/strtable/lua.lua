@@ -0,0 +1,37 @@
+local m = {}
+
+
+
+function m.new_particle(x, y, vx, vy)
+    return { x = x, y = y, vx = vx, vy = vy }
+end
+
+function m.simulate(particles, nsteps, dt)
+    local n = #particles
+    for _ = 1, nsteps do
+        for i = 1, n do
+            local p = particles[i]
+            local x = p.x + p.vx * dt
+            local y = p.y + p.vy * dt
+            if x < 0.0 or x > 1.0 then
+                p.vx = -p.vx
+            end
+            if y < 0.0 or y > 1.0 then
+                p.vy = -p.vy
+            end
+            p.x = x
+            p.y = y
+        end
+    end
+
+    local cx = 0.0
+    local cy = 0.0
+    for i = 1, n do
+        local p = particles[i]
+        cx = cx + p.x
+        cy = cy + p.y
+    end
+    return { cx / n, cy / n }
+end
+
+return m
@@ -0,0 +1,23 @@
+-- Tables with string keys.
+--
+-- The particles are ordinary Lua tables, with the fields x, y, vx and vy. In Pallene they have a
+-- table type instead of a record type, so every field access goes through pallene_getstr and its
+-- inline cache.
+
+local harness = require "benchmarks.harness"
+local strtable = require(arg[1])
+local N     = tonumber(arg[2]) or 1000
+local nstep = tonumber(arg[3]) or 10000
+
+local particles = {}
+for i = 1, N do
+    local t = i / N
+    particles[i] = strtable.new_particle(t, 1.0 - t, 0.3 - 0.2 * t, 0.1 + 0.2 * t)
+end
+
+local r
+harness.kernel(1, function()
+    r = strtable.simulate(particles, nstep, 0.01)
+end)
+print(string.format("%.6f", r[1]))
+print(string.format("%.6f", r[2]))
@@ -0,0 +1,163 @@
+-- Generator of large synthetic Pallene modules, used by the benchmarks/compile_time script to
+-- measure how fast the compiler itself is. The generated code is never executed; it only has to
+-- typecheck. Each "shape" stresses a different part of the compiler.
+
+local synthetic = {}
+
+--
+-- @param n_functions:      number of exported functions
+-- @param statements:       number of straight-line statements in each function
+-- @param nesting_depth:    depth of the nested loops and ifs in each function
+-- @param n_records:        number of record types
+-- @param record_fields:    number of fields in each record type
+-- @param n_string_tables:  number of functions that return an array of string literals
+-- @param table_size:       number of strings in each of those arrays
+--
+synthetic.SHAPES = {
+    functions = {
+        n_functions = 2000, statements = 10, nesting_depth = 1,
+        n_records = 0, record_fields = 0,
+        n_string_tables = 0, table_size = 0,
+    },
+    nesting = {
+        n_functions = 50, statements = 2, nesting_depth = 40,
+        n_records = 0, record_fields = 0,
+        n_string_tables = 0, table_size = 0,
+    },
+    records = {
+        n_functions = 0, statements = 0, nesting_depth = 0,
+        n_records = 50, record_fields = 100,
+        n_string_tables = 0, table_size = 0,
+    },
+    strings = {
+        n_functions = 0, statements = 0, nesting_depth = 0,
+        n_records = 0, record_fields = 0,
+        n_string_tables = 20, table_size = 2000,
+    },
+    mixed = {
+        n_functions = 300, statements = 10, nesting_depth = 8,
+        n_records = 10, record_fields = 30,
+        n_string_tables = 5, table_size = 500,
+    },
+}
+
+synthetic.SHAPE_NAMES = {}
+for name, _ in pairs(synthetic.SHAPES) do
+    table.insert(synthetic.SHAPE_NAMES, name)
+end
+table.sort(synthetic.SHAPE_NAMES)
+
+-- Multiplies the sizes of a shape by [scale]. The nesting depth is not scaled, because it affects
+-- the size of the functions exponentially.
+function synthetic.scale(shape, scale)
+    local out = {}
+    for k, v in pairs(shape) do
+        if k == "nesting_depth" then
+            out[k] = v
+        else
+            out[k] = math.max(0, math.floor(v * scale + 0.5))
+        end
+    end
+    return out
+end
+
+local function nested_body(out, depth, max_depth, statements)
+    local indent = string.rep("    ", depth + 1)
+    if depth == max_depth then
+        for j = 1, statements do
+            table.insert(out, string.format("%sacc = acc + x * %d - y // %d", indent, j, j))
+        end
+        return
+    end
+
+    local v = "i" .. depth
+    local kind = depth % 3
+    if kind == 0 then
+        table.insert(out, string.format("%sfor %s = 1, x do", indent, v))
+        table.insert(out, string.format("%s    acc = acc + %s", indent, v))
+    elseif kind == 1 then
+        table.insert(out, string.format("%sif acc > %d then", indent, depth))
+    else
+        table.insert(out, string.format("%slocal %s = %d", indent, v, depth))
+        table.insert(out, string.format("%swhile %s < y do", indent, v))
+        table.insert(out, string.format("%s    %s = %s + 1", indent, v, v))
+    end
+    nested_body(out, depth + 1, max_depth, statements)
+    if kind == 1 then
+        table.insert(out, string.format("%selse", indent))
+        table.insert(out, string.format("%s    acc = acc - %d", indent, depth))
+    end
+    table.insert(out, string.format("%send", indent))
+end
+
+-- Returns the source code of a Pallene module with the given shape.
+function synthetic.generate(shape)
+    local out = {}
+    table.insert(out, "local m: module = {}")
+    table.insert(out, "")
+
+    for r = 1, shape.n_records do
+        table.insert(out, string.format("record R%d", r))
+        for f = 1, shape.record_fields do
+            local typ = (f % 3 == 0 and "integer") or (f % 3 == 1 and "float") or "string"
+            table.insert(out, string.format("    f%d: %s", f, typ))
+        end
+        table.insert(out, "end")
+        table.insert(out, "")
+
+        local inits = {}
+        for f = 1, shape.record_fields do
+            local value = (f % 3 == 0 and tostring(f)) or (f % 3 == 1 and f .. ".5") or
+                string.format("%q", "field" .. f)
+            table.insert(inits, string.format("        f%d = %s,", f, value))
+        end
+        table.insert(out, string.format("function m.new_r%d(): R%d", r, r))
+        table.insert(out, "    return {")
+        table.insert(out, table.concat(inits, "\n"))
+        table.insert(out, "    }")
+        table.insert(out, "end")
+        table.insert(out, "")
+
+        local sum = { "0" }
+        for f = 3, shape.record_fields, 3 do
+            table.insert(sum, "r.f" .. f)
+        end
+        table.insert(out, string.format("function m.sum_r%d(r: R%d): integer", r, r))
+        table.insert(out, "    return " .. table.concat(sum, " + "))
+        table.insert(out, "end")
+        table.insert(out, "")
+    end
+
+    for t = 1, shape.n_string_tables do
+        table.insert(out, string.format("function m.strings%d(): {string}", t))
+        table.insert(out, "    return {")
+        for s = 1, shape.table_size do
+            local str = string.format("string %d of table %d", s, t)
+            table.insert(out, string.format("        %q,", str))
+        end
+        table.insert(out, "    }")
+        table.insert(out, "end")
+        table.insert(out, "")
+    end
+
+    for f = 1, shape.n_functions do
+        table.insert(out, string.format("function m.f%d(x: integer, y: integer): integer", f))
+        table.insert(out, "    local acc = 0")
+        for j = 1, shape.statements do
+            table.insert(out, string.format("    acc = acc + (x + %d) * (y - %d)", j, j))
+        end
+        nested_body(out, 0, shape.nesting_depth, shape.statements)
+        if f > 1 then
+            table.insert(out, string.format("    acc = acc + m.f%d(y, x)", f - 1))
+        end
+        table.insert(out, "    return acc")
+        table.insert(out, "end")
+        table.insert(out, "")
+    end
+
+    table.insert(out, "return m")
+    table.insert(out, "")
+    return table.concat(out, "\n")
+end
+
+return synthetic
@@ -210,7 +210,8 @@ static int countlevels(lua_State *L) {
 static void countframes(pt_fnstack_t *fnstack, int *mwhite, int *mblack) {
   *mwhite = *mblack = 0;
 
-  for(int i = 0; i < fnstack->count; i++) {
+  int count = (fnstack->count < fnstack->capacity) ? fnstack->count : fnstack->capacity;
+  for(int i = 0; i < count; i++) {
     *mwhite += (fnstack->stack[i].type == PALLENE_TRACER_FRAME_TYPE_C);
     *mblack += (fnstack->stack[i].type == PALLENE_TRACER_FRAME_TYPE_LUA);
   }
@@ -250,8 +251,10 @@ int debugtraceback(lua_State *L, const char* msg) {
   lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
   pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, -1);
   pt_frame_t *stack = fnstack->stack;
-  /* The point where we are in the Pallene stack. */
+  /* The point where we are in the Pallene stack. Frames past the capacity were not recorded. */
   int index = fnstack->count - 1;
+  if(index >= fnstack->capacity)
+    index = fnstack->capacity - 1;
   lua_pop(L, 1);
 
   /* Max number of white and black frames. */
@@ -354,6 +357,412 @@ int debugtraceback(lua_State *L, const char* msg) {
 
 /* ---------------- PALLENE TRACER CODE END ---------------- */
 
+/* ---------------- PALLENE TRACER PROFILER ---------------- */
+
+/* A sampling profiler. If the PT_PROFILE environment variable is set, a SIGPROF timer interrupts
+   the program PT_PROFILE_HZ times per second of CPU time (default 1000), and at exit the samples
+   are written to the file named by PT_PROFILE as folded stacks ("outer;inner count"), for
+   flamegraph tools.
+
+   The signal handler can't call the Lua API, because the interrupted code may be in the middle of
+   changing the Lua state. It only copies the Pallene frames from the call-stack into a ring
+   buffer, and asks for a count hook with `lua_sethook`, which is signal-safe. The hook runs at the
+   next instruction of the Lua VM, walks the Lua stack, and splices the Pallene frames into the
+   Lua frames the same way as `debugtraceback`. If the sampled Pallene code returned before the
+   hook ran, its frames are shown on top of the Lua frames of the hook.
+
+   Only the main Lua thread is sampled. */
+
+#if defined(__unix__) || defined(__APPLE__)
+#define PT_PROFILER_SUPPORTED
+#endif
+
+#ifdef PT_PROFILER_SUPPORTED
+
+#include <sys/time.h>
+
+/* Deeper stacks are truncated, keeping the innermost frames. */
+#define PT_PROFILE_MAX_DEPTH      64
+/* Capacity of the ring buffer, in samples. Must be a power of two. */
+#define PT_PROFILE_RING_SIZE      512
+/* Length of the copies of function names and sources. */
+#define PT_PROFILE_NAME_LEN       40
+
+/* A sample as the signal handler takes it: the innermost frames of the Pallene call-stack. */
+typedef struct pt_prof_raw {
+  volatile unsigned long count;                 /* Identical samples taken in a row. */
+  int nframes;                                  /* Innermost frame last, as in the call-stack. */
+  pt_frame_t frames[PT_PROFILE_MAX_DEPTH];
+} pt_prof_raw_t;
+
+typedef struct pt_prof_frame {
+  char name[PT_PROFILE_NAME_LEN];
+  char src[LUA_IDSIZE];
+  int line;                  /* Line where the function is defined, or -1. */
+} pt_prof_frame_t;
+
+/* A sample after the hook added the Lua frames. */
+typedef struct pt_prof_sample {
+  int nframes;                                  /* Innermost frame first. */
+  pt_prof_frame_t frames[PT_PROFILE_MAX_DEPTH];
+} pt_prof_sample_t;
+
+/* Single producer (the signal handler) and single consumer (the drain hook), both running on
+   the main thread, so volatile indices are enough: the handler may interrupt the consumer, but
+   never the other way around. While the consumer is draining, the handler doesn't touch the
+   samples that are already in the ring. */
+static pt_prof_raw_t *prof_ring = NULL;
+static volatile unsigned prof_head = 0;         /* Next slot to write. */
+static volatile unsigned prof_tail = 0;         /* Next slot to read. */
+static volatile unsigned long prof_dropped = 0;
+static volatile sig_atomic_t prof_draining = 0;
+
+static lua_State *prof_L = NULL;
+static pt_fnstack_t *prof_fnstack = NULL;
+static const char *prof_output = NULL;
+
+/* Aggregated folded stacks: open addressing hash table of "a;b;c" => count. */
+typedef struct pt_prof_entry {
+  char *stack;
+  unsigned long count;
+} pt_prof_entry_t;
+
+static pt_prof_entry_t *prof_table = NULL;
+static size_t prof_table_size = 0;
+static size_t prof_table_used = 0;
+
+static void prof_copy(char *dst, size_t len, const char *src) {
+  size_t i = 0;
+  if(src != NULL)
+    for(; i + 1 < len && src[i] != '\0'; i++)
+      dst[i] = src[i];
+  dst[i] = '\0';
+}
+
+static pt_prof_frame_t *prof_push(pt_prof_sample_t *s) {
+  if(s->nframes >= PT_PROFILE_MAX_DEPTH)
+    return NULL;
+  return &s->frames[s->nframes++];
+}
+
+static void prof_push_pallene(pt_prof_sample_t *s, pt_frame_t *frame) {
+  pt_prof_frame_t *f = prof_push(s);
+  if(f == NULL) return;
+  prof_copy(f->name, sizeof(f->name), frame->shared.details->fn_name);
+  prof_copy(f->src, sizeof(f->src), frame->shared.details->filename);
+  f->line = -1;
+}
+
+static void prof_push_lua(pt_prof_sample_t *s, lua_Debug *ar) {
+  pt_prof_frame_t *f = prof_push(s);
+  if(f == NULL) return;
+  if(*ar->what == 'm')
+    prof_copy(f->name, sizeof(f->name), "<main>");
+  else
+    prof_copy(f->name, sizeof(f->name), ar->name != NULL ? ar->name : "<?>");
+  if(*ar->what == 'C') {
+    prof_copy(f->src, sizeof(f->src), "[C]");
+    f->line = -1;
+  } else {
+    prof_copy(f->src, sizeof(f->src), ar->short_src);
+    f->line = ar->linedefined;
+  }
+}
+
+/* The line of a Pallene frame changes as it runs, but the profile doesn't show it. */
+static bool prof_same_frames(pt_prof_raw_t *r, pt_frame_t *stack, int first, int n) {
+  if(r->nframes != n)
+    return false;
+  for(int i = 0; i < n; i++) {
+    pt_frame_t *a = &r->frames[i], *b = &stack[first + i];
+    if(a->type != b->type || a->shared.details != b->shared.details)
+      return false;
+  }
+  return true;
+}
+
+static void prof_drain_hook(lua_State *L, lua_Debug *ar);
+
+static void prof_request_drain(void) {
+  /* Unless someone else (the SIGINT handler) is using the hook. */
+  lua_Hook hook = lua_gethook(prof_L);
+  if(hook == NULL || hook == prof_drain_hook)
+    lua_sethook(prof_L, prof_drain_hook, LUA_MASKCOUNT, 1);
+}
+
+static void prof_signal(int sig) {
+  (void) sig;
+
+  int n = 0, first = 0;
+  pt_frame_t *stack = NULL;
+  if(prof_fnstack != NULL) {
+    stack = prof_fnstack->stack;
+    n = prof_fnstack->count;
+    if(n > prof_fnstack->capacity)
+      n = prof_fnstack->capacity;
+    if(n > PT_PROFILE_MAX_DEPTH)
+      first = n - PT_PROFILE_MAX_DEPTH;
+    n -= first;
+  }
+
+  /* Pallene code that doesn't go back to the Lua VM for a long time takes many samples before the
+     hook runs, and they are all the same, so we count them in one slot. */
+  unsigned head = prof_head;
+  if(!prof_draining && head != prof_tail) {
+    pt_prof_raw_t *last = &prof_ring[(head - 1) & (PT_PROFILE_RING_SIZE - 1)];
+    if(prof_same_frames(last, stack, first, n)) {
+      last->count++;
+      prof_request_drain();
+      return;
+    }
+  }
+
+  if(head - prof_tail >= PT_PROFILE_RING_SIZE) {
+    prof_dropped++;
+    return;
+  }
+
+  pt_prof_raw_t *r = &prof_ring[head & (PT_PROFILE_RING_SIZE - 1)];
+  r->count = 1;
+  r->nframes = n;
+  for(int i = 0; i < n; i++)
+    r->frames[i] = stack[first + i];
+
+  prof_head = head + 1;
+  prof_request_drain();
+}
+
+static unsigned long prof_hash(const char *s) {
+  unsigned long h = 5381;
+  for(; *s != '\0'; s++)
+    h = h * 33 + (unsigned char) *s;
+  return h;
+}
+
+static void prof_table_add(char *stack, unsigned long count);
+
+static void prof_table_grow(void) {
+  pt_prof_entry_t *old = prof_table;
+  size_t old_size = prof_table_size;
+
+  prof_table_size = old_size == 0 ? 1024 : 2 * old_size;
+  prof_table = calloc(prof_table_size, sizeof(pt_prof_entry_t));
+  prof_table_used = 0;
+  if(prof_table == NULL) {
+    fprintf(stderr, "pt-lua: out of memory in the profiler\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for(size_t i = 0; i < old_size; i++)
+    if(old[i].stack != NULL)
+      prof_table_add(old[i].stack, old[i].count);
+  free(old);
+}
+
+/* Takes ownership of `stack`. */
+static void prof_table_add(char *stack, unsigned long count) {
+  if(2 * (prof_table_used + 1) > prof_table_size)
+    prof_table_grow();
+
+  size_t i = prof_hash(stack) & (prof_table_size - 1);
+  while(prof_table[i].stack != NULL) {
+    if(strcmp(prof_table[i].stack, stack) == 0) {
+      prof_table[i].count += count;
+      free(stack);
+      return;
+    }
+    i = (i + 1) & (prof_table_size - 1);
+  }
+  prof_table[i].stack = stack;
+  prof_table[i].count = count;
+  prof_table_used++;
+}
+
+/* Renders a sample as a folded stack, outermost frame first. */
+static char *prof_fold(pt_prof_sample_t *s) {
+  size_t len = 1;
+  char buf[PT_PROFILE_NAME_LEN + LUA_IDSIZE + 32];
+  for(int i = 0; i < s->nframes; i++)
+    len += sizeof(buf);
+
+  char *out = malloc(len);
+  if(out == NULL) return NULL;
+  out[0] = '\0';
+
+  size_t pos = 0;
+  for(int i = s->nframes - 1; i >= 0; i--) {
+    pt_prof_frame_t *f = &s->frames[i];
+    int n;
+    if(f->line >= 0)
+      n = snprintf(buf, sizeof(buf), "%s (%s:%d)", f->name, f->src, f->line);
+    else
+      n = snprintf(buf, sizeof(buf), "%s (%s)", f->name, f->src);
+    /* ';' separates the frames in the folded format. */
+    for(int j = 0; j < n && buf[j] != '\0'; j++)
+      if(buf[j] == ';') buf[j] = ',';
+    pos += (size_t) snprintf(out + pos, len - pos, "%s%s", pos > 0 ? ";" : "", buf);
+  }
+  return out;
+}
+
+/* Adds the Lua frames that are active now to a raw sample. The Lua interface frames of the
+   Pallene code that returned since the sample was taken are no longer in the Lua stack, so we
+   count the ones that are still there, and show the rest of the Pallene frames first. */
+static void prof_resolve(lua_State *L, pt_prof_raw_t *r, pt_prof_sample_t *s) {
+  pt_frame_t *stack = r->frames;
+  int index = r->nframes - 1;
+  s->nframes = 0;
+
+  int sampled = 0, active = 0;
+  for(int i = 0; i <= index; i++)
+    if(stack[i].type == PALLENE_TRACER_FRAME_TYPE_LUA)
+      sampled++;
+
+  lua_Debug ar;
+  int level = 0;
+  while(lua_getstack(L, level++, &ar)) {
+    lua_getinfo(L, "f", &ar);
+    lua_CFunction fn = lua_tocfunction(L, -1);
+    lua_pop(L, 1);
+    for(int i = 0; fn != NULL && i <= index; i++) {
+      if(stack[i].type == PALLENE_TRACER_FRAME_TYPE_LUA && stack[i].shared.c_fnptr == fn) {
+        active++;
+        break;
+      }
+    }
+  }
+
+  for(int returned = sampled - active; returned > 0 && index >= 0; index--) {
+    if(stack[index].type == PALLENE_TRACER_FRAME_TYPE_LUA)
+      returned--;
+    else
+      prof_push_pallene(s, &stack[index]);
+  }
+
+  level = 0;
+  while(s->nframes < PT_PROFILE_MAX_DEPTH && lua_getstack(L, level++, &ar)) {
+    lua_getinfo(L, "Snf", &ar);
+    lua_CFunction fn = lua_tocfunction(L, -1);
+    lua_pop(L, 1);
+
+    if(fn != NULL && index >= 0) {
+      int check = index;
+      while(check >= 0 && stack[check].type != PALLENE_TRACER_FRAME_TYPE_LUA)
+        check--;
+
+      if(check >= 0 && stack[check].shared.c_fnptr == fn) {
+        for(; index > check; index--)
+          prof_push_pallene(s, &stack[index]);
+        index--;  /* The Lua interface frame. */
+        continue;
+      }
+    }
+
+    prof_push_lua(s, &ar);
+  }
+}
+
+static void prof_drain(lua_State *L) {
+  static pt_prof_sample_t sample;
+  prof_draining = 1;
+  unsigned head = prof_head;
+  while(prof_tail != head) {
+    pt_prof_raw_t *r = &prof_ring[prof_tail & (PT_PROFILE_RING_SIZE - 1)];
+    prof_resolve(L, r, &sample);
+    char *stack = prof_fold(&sample);
+    if(stack != NULL && stack[0] != '\0')
+      prof_table_add(stack, r->count);
+    else
+      free(stack);
+    prof_tail++;
+  }
+  prof_draining = 0;
+}
+
+static void prof_drain_hook(lua_State *L, lua_Debug *ar) {
+  (void) ar;
+  lua_sethook(L, NULL, 0, 0);
+  prof_drain(L);
+}
+
+static void prof_start(lua_State *L, pt_fnstack_t *fnstack) {
+  prof_output = getenv("PT_PROFILE");
+  if(prof_output == NULL || prof_output[0] == '\0')
+    return;
+
+  long hz = 1000;
+  const char *hz_env = getenv("PT_PROFILE_HZ");
+  if(hz_env != NULL && atol(hz_env) > 0)
+    hz = atol(hz_env);
+
+  prof_ring = malloc(PT_PROFILE_RING_SIZE * sizeof(pt_prof_raw_t));
+  if(prof_ring == NULL) {
+    fprintf(stderr, "pt-lua: not enough memory for the profiler\n");
+    prof_output = NULL;
+    return;
+  }
+  prof_L = L;
+  prof_fnstack = fnstack;
+
+  struct sigaction sa;
+  sa.sa_handler = prof_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGPROF, &sa, NULL);
+
+  struct itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = hz >= 1000000 ? 1 : 1000000 / hz;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+/* Stops the timer and writes the folded stacks. Must be called before `lua_close`. */
+static void prof_stop(void) {
+  if(prof_output == NULL)
+    return;
+
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  signal(SIGPROF, SIG_IGN);
+  if(lua_gethook(prof_L) == prof_drain_hook)
+    lua_sethook(prof_L, NULL, 0, 0);
+  prof_drain(prof_L);
+
+  FILE *f = fopen(prof_output, "w");
+  if(f == NULL) {
+    fprintf(stderr, "pt-lua: cannot open %s for writing\n", prof_output);
+  } else {
+    for(size_t i = 0; i < prof_table_size; i++)
+      if(prof_table[i].stack != NULL)
+        fprintf(f, "%s %lu\n", prof_table[i].stack, prof_table[i].count);
+    fclose(f);
+  }
+  if(prof_dropped > 0)
+    fprintf(stderr, "pt-lua: the profiler dropped %lu samples\n", prof_dropped);
+
+  for(size_t i = 0; i < prof_table_size; i++)
+    free(prof_table[i].stack);
+  free(prof_table);
+  free(prof_ring);
+  prof_output = NULL;
+}
+
+#else
+
+static void prof_start(lua_State *L, pt_fnstack_t *fnstack) {
+  (void) L; (void) fnstack;
+  if(getenv("PT_PROFILE") != NULL)
+    fprintf(stderr, "pt-lua: the profiler is not supported on this platform\n");
+}
+
+static void prof_stop(void) {}
+
+#endif // PT_PROFILER_SUPPORTED
+
+/* ---------------- PALLENE TRACER PROFILER END ---------------- */
+
 
 /*
 ** Hook set by signal function to stop the interpreter.
@@ -981,8 +1390,9 @@ int main (int argc, char **argv) {
   lua_gc(L, LUA_GCSTOP);  /* stop GC while building state */
 
   /* -------- PALLENE TRACER CODE -------- */
-  (void) pallene_tracer_init(L);  /* initialize pallene tracer */
+  pt_fnstack_t *fnstack = pallene_tracer_init(L);  /* initialize pallene tracer */
   lua_pop(L, 1);  /* We do not need the finalizer object here */
+  prof_start(L, fnstack);  /* start the profiler, if PT_PROFILE is set */
   /* -------- PALLENE TRACER CODE END -------- */
 
   lua_pushcfunction(L, &pmain);  /* to call 'pmain' in protected mode */
@@ -991,6 +1401,7 @@ int main (int argc, char **argv) {
   status = lua_pcall(L, 2, 1, 0);  /* do the call */
   result = lua_toboolean(L, -1);  /* get result */
   report(L, status);
+  prof_stop();  /* write the profile, before the Lua state goes away */
   lua_close(L);
   return (result && status == LUA_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
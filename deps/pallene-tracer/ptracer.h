@@ -39,9 +39,18 @@
 /* DO NOT CHANGE EVEN BY MISTAKE. */
 #define PALLENE_TRACER_FINALIZER_ENTRY  "__PALLENE_TRACER_FINALIZER"
 
-/* The size of the Pallene call-stack. */
-/* DO NOT CHANGE EVEN BY MISTAKE. */
+/* The maximum size of the Pallene call-stack. The stack starts empty and doubles in size
+   when it gets full, up to this many frames. Deeper frames are counted but not recorded. */
+/* The stack remembers the maximum it was created with, so it is fine if different modules
+   are compiled with different values. */
+#ifndef PALLENE_TRACER_MAX_CALLSTACK
 #define PALLENE_TRACER_MAX_CALLSTACK         100000
+#endif
+
+/* How many frames we allocate the first time a frame is pushed. */
+#ifndef PALLENE_TRACER_INITIAL_CALLSTACK
+#define PALLENE_TRACER_INITIAL_CALLSTACK     64
+#endif
 
 /* API wrapper macros. Using these wrappers instead is raw functions
  * are highly recommended. */
@@ -162,9 +171,13 @@ typedef struct pt_frame {
 
 /* Our stack is fully heap-allocated stack. We need some structure to hold
    the stack information. This structure will be an Userdatum. */
+/* Only the first `capacity` frames are stored. The `count` may be greater
+   than that if we have reached `max_capacity`. */
 typedef struct pt_fnstack {
     pt_frame_t *stack;
     int count;
+    int capacity;
+    int max_capacity;
 } pt_fnstack_t;
 
 /* ---------------- DATA STRUCTURES END ---------------- */
@@ -182,18 +195,24 @@ extern "C" {
    everytime you are in a Lua C function using `lua_toclose(L, idx)`. */
 PT_API pt_fnstack_t *pallene_tracer_init(lua_State *L);
 
+/* Makes room for more frames, unless the stack is already at its maximum size. */
+PT_API void pallene_tracer_grow(pt_fnstack_t *fnstack);
+
 /* Pushes a frame to the stack. The frame structure is self-managed for every function. */
 static inline void pallene_tracer_frameenter(pt_fnstack_t *fnstack, pt_frame_t *restrict frame) {
-    /* Have we ran out of stack entries? If we do, stop pushing frames. */
-    if(luai_likely(fnstack->count < PALLENE_TRACER_MAX_CALLSTACK))
+    /* Have we ran out of stack entries? If we can't grow, stop pushing frames. */
+    if(luai_unlikely(fnstack->count >= fnstack->capacity))
+        pallene_tracer_grow(fnstack);
+
+    if(luai_likely(fnstack->count < fnstack->capacity))
         fnstack->stack[fnstack->count] = *frame;
 
     fnstack->count++;
 }
 
-/* Sets line number to the topmost frame in the stack. */
+/* Sets line number to the topmost frame in the stack, if it was recorded. */
 static inline void pallene_tracer_setline(pt_fnstack_t *fnstack, int line) {
-    if(luai_likely(fnstack->count != 0))
+    if(luai_likely((unsigned) (fnstack->count - 1) < (unsigned) fnstack->capacity))
         fnstack->stack[fnstack->count - 1].line = line;
 }
 
@@ -228,8 +247,12 @@ static int _pallene_tracer_finalizer(lua_State *L) {
 
     /* Remove all the frames until last Lua frame. */
     int idx = fnstack->count - 1;
-    while(fnstack->stack[idx].type != PALLENE_TRACER_FRAME_TYPE_LUA)
+    if(idx >= fnstack->capacity)
+        idx = fnstack->capacity - 1;
+    while(idx >= 0 && fnstack->stack[idx].type != PALLENE_TRACER_FRAME_TYPE_LUA)
         idx--;
+    if(idx < 0)
+        idx = 0;
 
     /* Remove the Lua frame as well. */
     fnstack->count = idx;
@@ -246,6 +269,14 @@ static int _pallene_tracer_free_resources(lua_State *L) {
     return 0;
 }
 
+/* The pt-lua profiler reads the stack from a signal handler, so the new frames must be in
+   place before we publish the new array, and the array before its capacity. */
+#if defined(__GNUC__)
+#define _PALLENE_TRACER_SIGNAL_FENCE()    __atomic_signal_fence(__ATOMIC_SEQ_CST)
+#else
+#define _PALLENE_TRACER_SIGNAL_FENCE()
+#endif
+
 /* ---------------- PRIVATE END ---------------- */
 
 /* ---------------- DEFINITIONS ---------------- */
@@ -266,9 +297,12 @@ pt_fnstack_t *pallene_tracer_init(lua_State *L) {
 
     /* If we don't find any userdata, initialize resources. */
     if(luai_unlikely(lua_isnil(L, -1) == 1)) {
+        /* The frames are only allocated when the first one is pushed. */
         fnstack = (pt_fnstack_t *) lua_newuserdata(L, sizeof(pt_fnstack_t));
-        fnstack->stack = malloc(PALLENE_TRACER_MAX_CALLSTACK * sizeof(pt_frame_t));
+        fnstack->stack = NULL;
         fnstack->count = 0;
+        fnstack->capacity = 0;
+        fnstack->max_capacity = PALLENE_TRACER_MAX_CALLSTACK;
 
         /* Prepare the `__gc` finalizer to free the stack. */
         lua_newtable(L);
@@ -307,6 +341,32 @@ pt_fnstack_t *pallene_tracer_init(lua_State *L) {
 #endif // PT_DEBUG
 }
 
+/* Makes room for more frames, unless the stack is already at its maximum size. */
+/* Doubles the capacity, so pushing frames is amortized constant time. If there is
+   no memory, we keep the old stack and the frames that don't fit are not recorded. */
+void pallene_tracer_grow(pt_fnstack_t *fnstack) {
+    int old_capacity = fnstack->capacity;
+    if(old_capacity >= fnstack->max_capacity)
+        return;
+
+    int new_capacity = (old_capacity > 0) ? 2 * old_capacity : PALLENE_TRACER_INITIAL_CALLSTACK;
+    if(new_capacity > fnstack->max_capacity || new_capacity <= 0)
+        new_capacity = fnstack->max_capacity;
+
+    pt_frame_t *old_stack = fnstack->stack;
+    pt_frame_t *new_stack = malloc(new_capacity * sizeof(pt_frame_t));
+    if(new_stack == NULL)
+        return;
+    if(old_capacity > 0)
+        memcpy(new_stack, old_stack, old_capacity * sizeof(pt_frame_t));
+
+    _PALLENE_TRACER_SIGNAL_FENCE();
+    fnstack->stack = new_stack;
+    _PALLENE_TRACER_SIGNAL_FENCE();
+    fnstack->capacity = new_capacity;
+    free(old_stack);
+}
+
 /* ---------------- DEFINITIONS END ---------------- */
 
 #endif
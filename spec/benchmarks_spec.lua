@@ -55,6 +55,10 @@ test_benchmark("centroid", {10, 1}, [[
 17.27825	17.27825
 ]])
 
+test_benchmark("closures", {10, 3}, [[
+1.414519853
+]])
+
 test_benchmark("conway", {1, 1}, "\027[2J\027[H" .. [[
 |            **   **       *          **   **       *          **   **       *   |
 | *    *    **   **   *     **  *    **   **   *     **  *    **   **   *     ** |
@@ -98,6 +102,11 @@ test_benchmark("conway", {1, 1}, "\027[2J\027[H" .. [[
 |           *    *                   *    *                   *    *             |
 ]])
 
+test_benchmark("dynamic", {10, 3}, [[
+81.117676
+10	0
+]])
+
 test_benchmark("fannkuchredux", {5, 1}, [[
 11
 Pfannkuchen(5) = 7
@@ -146,6 +155,11 @@ X - - -
 
 ]])
 
+test_benchmark("records", {10, 3}, [[
+4500.000000
+887.078699
+]])
+
 test_benchmark("sieve", {50, 1}, [[
 15
 ]])
@@ -153,3 +167,24 @@ test_benchmark("sieve", {50, 1}, [[
 test_benchmark("spectralnorm", {20, 1}, [[
 1.273839841
 ]])
+
+test_benchmark("strings", {10, 3}, [[
+id=37 value=0.125;
+id=370 value=1.25;
+181
+]])
+
+test_benchmark("strtable", {10, 3}, [[
+0.555300
+0.456300
+]])
+
+describe("kernel mode /", function()
+    it("binsearch", function()
+        -- Builds benchclock.so and times the kernel in-process; see benchmarks/harness.lua.
+        local data = benchlib.run_with_impl_name("kernel", "binsearch", "pallene", {100, 10})
+        assert.are.same("1", data.ops)
+        assert.truthy(tonumber(data.ns_per_op))
+        assert.truthy(tonumber(data.time))
+    end)
+end)
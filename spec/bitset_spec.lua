@@ -0,0 +1,38 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local bitset = require "pallene.bitset"
+
+describe("Bitsets", function()
+
+    it("can add and remove elements", function()
+        local bs = bitset.new(bitset.nwords(200))
+        bitset.add(bs, 1)
+        bitset.add(bs, 64)
+        bitset.add(bs, 65)
+        bitset.add(bs, 200)
+        assert.truthy(bitset.contains(bs, 64))
+        assert.falsy(bitset.contains(bs, 63))
+        bitset.remove(bs, 64)
+        assert.falsy(bitset.contains(bs, 64))
+        assert.same({1, 65, 200}, bitset.elements(bs))
+    end)
+
+    it("lists the elements in increasing order", function()
+        local set = { [128] = true, [3] = true, [129] = true, [63] = true, [192] = true }
+        local bs = bitset.from_set(set, bitset.nwords(192))
+        assert.same({3, 63, 128, 129, 192}, bitset.elements(bs))
+        assert.same(set, bitset.to_set(bs))
+    end)
+
+    it("reports whether a union changed the destination", function()
+        local n = bitset.nwords(100)
+        local a = bitset.from_set({ [1] = true, [99] = true }, n)
+        local b = bitset.from_set({ [99] = true }, n)
+        assert.falsy(bitset.union_into(a, b))
+        assert.truthy(bitset.union_into(b, a))
+        assert.same({1, 99}, bitset.elements(b))
+    end)
+end)
@@ -267,6 +267,14 @@ function execution_tests.run(compile_file, backend, _ENV, only_compile)
                 return l_odd(n)
             end
             -----------
+            function m.nest(n: integer): {any}
+                local t: {any} = {}
+                if n > 0 then
+                    t[1] = m.nest(n-1)
+                end
+                return t
+            end
+            -----------
             function m.skip_a() end
             function m.skip_b() m.skip_a(); m.skip_a() end
             -----------
@@ -314,6 +322,18 @@ function execution_tests.run(compile_file, backend, _ENV, only_compile)
             ]])
         end)
 
+        it("deep recursion grows the stack", function()
+            run_test([[
+                local t = test.nest(10000)
+                local depth = 0
+                while t[1] do
+                    t = t[1]
+                    depth = depth + 1
+                end
+                assert(10000 == depth)
+            ]])
+        end)
+
         it("void functions", function()
             run_test([[ assert(0 == select("#", test.skip_b())) ]])
         end)
@@ -3216,6 +3236,13 @@ function execution_tests.run(compile_file, backend, _ENV, only_compile)
             ]])
         end)
 
+        it("creates non-capturing closures only once", function()
+            run_test([[
+                assert(test.make_incrementer() == test.make_incrementer())
+                assert(test.make_adder(10) ~= test.make_adder(10))
+            ]])
+        end)
+
         it("capturing closures work as expected", function()
             run_test([[assert(test.add(10, 20) == 30)]])
         end)
@@ -0,0 +1,63 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local driver = require "pallene.driver"
+local ir = require "pallene.ir"
+local ir_verifier = require "pallene.ir_verifier"
+
+local function compile(src)
+    local module, errs = driver.compile_internal("__test__.pln", src, "optimize", 2,
+        { verify_ir = true })
+    assert(module, errs and table.concat(errs, "\n"))
+    return module
+end
+
+local program = [[
+    local m: module = {}
+    function m.f(n: integer): integer
+        local s = 0
+        for i = 1, n do
+            if i % 2 == 0 then s = s + i end
+        end
+        return s
+    end
+    return m
+]]
+
+describe("IR verifier", function()
+
+    it("accepts the output of the compiler", function()
+        local module = compile(program)
+        assert.is_true(ir_verifier.verify(module))
+    end)
+
+    it("detects jumps to nonexistent blocks", function()
+        local module = compile(program)
+        local func = module.functions[2]
+        table.insert(func.blocks[1].cmds, ir.Cmd.Jmp(#func.blocks + 1))
+        local ok, errs = ir_verifier.verify(module)
+        assert.is_false(ok)
+        assert.match("jumps to nonexistent block", table.concat(errs, "\n"), 1, true)
+    end)
+
+    it("detects jumps in the middle of a block", function()
+        local module = compile(program)
+        local func = module.functions[2]
+        table.insert(func.blocks[1].cmds, 1, ir.Cmd.Jmp(1))
+        local ok, errs = ir_verifier.verify(module)
+        assert.is_false(ok)
+        assert.match("jump in the middle of a basic block", table.concat(errs, "\n"), 1, true)
+    end)
+
+    it("detects undefined variables", function()
+        local module = compile(program)
+        local func = module.functions[2]
+        table.insert(func.blocks[1].cmds, 1,
+            ir.Cmd.Move(false, #func.vars + 1, ir.Value.Integer(0)))
+        local ok, errs = ir_verifier.verify(module)
+        assert.is_false(ok)
+        assert.match("writes to undefined variable", table.concat(errs, "\n"), 1, true)
+    end)
+end)
@@ -0,0 +1,27 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local json = require "pallene.json"
+
+describe("JSON", function()
+
+    it("encodes objects with sorted keys", function()
+        local s = json.encode({ b = { 1, 2.5, "x\n" }, a = true, c = {}, d = json.null })
+        assert.equals('{"a":true,"b":[1,2.5,"x\\n"],"c":[],"d":null}', s)
+    end)
+
+    it("round-trips through the decoder", function()
+        local value = { results = { { name = "sieve", times = { 0.125, 3, 1e-9 } } }, ok = false }
+        local decoded = json.decode(json.encode(value, "  "))
+        assert.same(value, decoded)
+        assert.equals("integer", math.type(decoded.results[1].times[2]))
+    end)
+
+    it("reports syntax errors", function()
+        local ok, err = json.decode('{"a": [1, 2}')
+        assert.falsy(ok)
+        assert.matches("expected ']'", err)
+    end)
+end)
@@ -3,6 +3,7 @@
 -- Please refer to the LICENSE and AUTHORS files for details
 -- SPDX-License-Identifier: MIT
 
+local json = require "pallene.json"
 local util = require "pallene.util"
 
 local function file_exists(name)
@@ -10,6 +11,10 @@ local function file_exists(name)
    return f ~= nil and io.close(f)
 end
 
+-- The instrumentation uses more of the C library than the rest of the runtime, so we compile it with
+-- the strict flags of ./run-tests, even if busted was called directly.
+local strict_pallenec = "env CFLAGS='-O0 -std=c99 -Wall -Werror -Wundef -Wno-unused' pallenec"
+
 
 describe("pallenec", function()
     before_each(function()
@@ -56,6 +61,245 @@ describe("pallenec", function()
         assert.equals("17\n", out)
     end)
 
+    it("Can compile in a single C compiler call", function()
+        assert(util.execute("pallenec --pipe --lto __test__.pln"))
+        assert(not file_exists("__test__.c"))
+        local ok, err, out, _ = util.outputs_of_execute("lua __test__script__.lua")
+        assert(ok, err)
+        assert.equals("17\n", out)
+        assert(file_exists("__test__.d.pln"))
+    end)
+
+    it("Can split the C code into several translation units", function()
+        assert(util.execute("pallenec --split-units 4 __test__.pln"))
+        local ok, err, out, _ = util.outputs_of_execute("lua __test__script__.lua")
+        assert(ok, err)
+        assert.equals("17\n", out)
+        assert(file_exists("__test__.d.pln"))
+    end)
+
+    it("Can do profile guided optimization", function()
+        assert(util.execute("pallenec --pgo-generate=__test__pgo__ __test__.pln"))
+        local ok1, err1, out1, _ = util.outputs_of_execute("lua __test__script__.lua")
+        local has_profile = file_exists("__test__pgo__/__test__.pallene-profile")
+        local ok2, err2 = util.execute("pallenec --pgo-use=__test__pgo__ __test__.pln")
+        local ok3, err3, out3, _ = util.outputs_of_execute("lua __test__script__.lua")
+        util.execute("rm -rf __test__pgo__")
+        assert(ok1, err1)
+        assert.equals("17\n", out1)
+        assert(has_profile)
+        assert(ok2, err2)
+        assert(ok3, err3)
+        assert.equals("17\n", out3)
+    end)
+
+    it("Can use a profile where some branches never ran", function()
+        util.set_file_contents("__test__.pln", [[
+            local m: module = {}
+            function m.f(x: integer): integer
+                local y: integer
+                if x > 0 then
+                    y = 2 * x
+                else
+                    y = -x
+                end
+                return y + 1
+            end
+            return m
+        ]])
+        util.set_file_contents("__test__train__.lua", [[
+            local test = require "__test__"
+            for i = 1, 10 do test.f(i) end
+        ]])
+        util.set_file_contents("__test__branches__.lua", [[
+            local test = require "__test__"
+            print(test.f(5), test.f(-3))
+        ]])
+        local ok1, err1 = util.execute("pallenec --pgo-generate=__test__pgo__ __test__.pln")
+        local ok2, err2 = util.execute("lua __test__train__.lua")
+        local ok3, err3 = util.execute("pallenec --pgo-use=__test__pgo__ __test__.pln")
+        local ok4, err4, out4, _ = util.outputs_of_execute("timeout 10 lua __test__branches__.lua")
+        util.execute("rm -rf __test__pgo__")
+        os.remove("__test__train__.lua")
+        os.remove("__test__branches__.lua")
+        assert(ok1, err1)
+        assert(ok2, err2)
+        assert(ok3, err3)
+        assert(ok4, err4)
+        assert.equals("11\t4\n", out4)
+    end)
+
+    it("Can count the calls of each function", function()
+        util.set_file_contents("__test__stats__.lua", [[
+            local test = require "__test__"
+            for i = 1, 10 do test.f(i) end
+            for _, s in ipairs(test.__pallene_stats()) do
+                if s.name == "f" then
+                    print(s.calls, s.lua_calls, s.time >= s.self_time, s.lua_time >= s.time)
+                end
+            end
+        ]])
+        local ok1, err1 = util.execute(strict_pallenec .. " --instrument __test__.pln")
+        local ok2, err2, out2, _ = util.outputs_of_execute("lua __test__stats__.lua")
+        local ok3, err3 = util.execute(strict_pallenec .. " --instrument --split-units 2 __test__.pln")
+        local ok4, err4, out4, _ = util.outputs_of_execute("lua __test__stats__.lua")
+        os.remove("__test__stats__.lua")
+        assert(ok1, err1)
+        assert(ok2, err2)
+        assert.equals("10\t10\ttrue\ttrue\n", out2)
+        assert(ok3, err3)
+        assert(ok4, err4)
+        assert.equals("10\t10\ttrue\ttrue\n", out4)
+    end)
+
+    it("Can count the allocations of each line", function()
+        util.set_file_contents("__test__.pln", [[
+            local m: module = {}
+            function m.f(n: integer): {integer}
+                local xs: {integer} = {}
+                for i = 1, n do
+                    xs[i] = i
+                end
+                return xs
+            end
+            function m.g(s: string): string
+                return s .. "!"
+            end
+            return m
+        ]])
+        util.set_file_contents("__test__allocs__.lua", [[
+            local test = require "__test__"
+            for i = 1, 10 do test.f(i) end
+            for _ = 1, 5 do test.g("x") end
+            for _, s in ipairs(test.__pallene_allocs()) do
+                if s.func ~= "$init" then
+                    print(s.func, s.kind, s.line, s.count, s.bytes > 0, s.gc_time >= 0)
+                end
+            end
+        ]])
+        local ok1, err1 = util.execute(strict_pallenec .. " --instrument-allocs __test__.pln")
+        local ok2, err2, out2, _ = util.outputs_of_execute("lua __test__allocs__.lua")
+        os.remove("__test__allocs__.lua")
+        assert(ok1, err1)
+        assert(ok2, err2)
+        assert.equals("f\tarray\t3\t10\ttrue\ttrue\ng\tstring\t10\t5\ttrue\ttrue\n", out2)
+    end)
+
+    it("Can count the runtime checks", function()
+        util.set_file_contents("__test__checks__.lua", [[
+            local test = require "__test__"
+            for i = 1, 10 do test.f(i) end
+            local s = test.__pallene_checks()[1]
+            print(s.func, s.line, s.kind, s.what, s.count)
+        ]])
+        local ok1, err1 = util.execute("pallenec --instrument-checks __test__.pln")
+        local ok2, err2, out2, _ = util.outputs_of_execute("lua __test__checks__.lua")
+        local ok3, err3 = util.execute("pallenec --instrument-checks --split-units 2 __test__.pln")
+        local ok4, err4, out4, _ = util.outputs_of_execute("lua __test__checks__.lua")
+        os.remove("__test__checks__.lua")
+        assert(ok1, err1)
+        assert(ok2, err2)
+        assert.equals("f\t2\ttag_check\targument 'x' (integer)\t10\n", out2)
+        assert(ok3, err3)
+        assert(ok4, err4)
+        assert.equals("f\t2\ttag_check\targument 'x' (integer)\t10\n", out4)
+    end)
+
+    it("Can generate batch entry points", function()
+        util.set_file_contents("__test__batch__.lua", [[
+            local test = require "__test__"
+            local out = {}
+            test.__pallene_batch.f({1, 2, 3}, out)
+            print(table.concat(out, " "))
+            local _, err = pcall(test.__pallene_batch.f, {1, "2"}, out)
+            print(err)
+        ]])
+        local ok1, err1 = util.execute("pallenec --batch-entry-points __test__.pln")
+        local ok2, err2, out2, _ = util.outputs_of_execute("lua __test__batch__.lua")
+        os.remove("__test__batch__.lua")
+        assert(ok1, err1)
+        assert(ok2, err2)
+        assert.equals("18 19 20\n" ..
+            "file __test__.pln: line 2: wrong type for element of argument 'x', " ..
+            "expected integer but found string\n", out2)
+    end)
+
+    it("Can emit a header for the C API", function()
+        local ok, err = util.execute("pallenec --emit-c-api __test__.pln")
+        local header = util.get_file_contents("__test___api.h")
+        os.remove("__test___api.h")
+        assert(ok, err)
+        assert.truthy(header)
+        local prototype = "lua_Integer pallene___test___f(" ..
+            "lua_State *L, pallene___test___api *api, lua_Integer x1);"
+        assert.truthy(string.find(header, prototype, 1, true))
+    end)
+
+    it("Can call the C API from a C program", function()
+        util.set_file_contents("__test__host__.c", [[
+            #include <stdio.h>
+            #include <lauxlib.h>
+            #include <lualib.h>
+            #include "__test___api.h"
+
+            static int run(lua_State *L)
+            {
+                luaL_requiref(L, "__test__", luaopen___test__, 0);
+                pallene___test___api *api = pallene___test___open_api(L, -1);
+                printf("%lld\n", (long long) pallene___test___f(L, api, 25));
+                printf("%d\n", pallene___test___open_api(L, -1) == api);
+                return 0;
+            }
+
+            int main(void)
+            {
+                lua_State *L = luaL_newstate();
+                luaL_openlibs(L);
+                lua_pushcfunction(L, run);
+                if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+                    fprintf(stderr, "%s\n", lua_tostring(L, -1));
+                    return 1;
+                }
+                lua_close(L);
+                return 0;
+            }
+        ]])
+        -- The host links with the module, and exports the Lua API for it with -Wl,-E.
+        local cc = os.getenv("CC") or "cc"
+        local cflags = os.getenv("CFLAGS") or "-O2"
+        local ok1, err1 = util.execute("pallenec --emit-c-api __test__.pln")
+        local ok2, err2 = util.execute(string.format(
+            "%s %s -I. __test__host__.c ./__test__.so -o __test__host__ -Wl,-E -llua -lm -ldl",
+            cc, cflags))
+        local ok3, err3, out3, _ = util.outputs_of_execute("./__test__host__")
+        os.remove("__test___api.h")
+        os.remove("__test__host__.c")
+        os.remove("__test__host__")
+        assert(ok1, err1)
+        assert(ok2, err2)
+        assert(ok3, err3)
+        assert.equals("42\n1\n", out3)
+    end)
+
+    it("Can show optimization remarks", function()
+        local ok, err, out, _ = util.outputs_of_execute("pallenec --remarks __test__.pln")
+        assert(ok, err)
+        local remarks = assert(json.decode(out))
+        assert.equals("__test__.pln", remarks.file)
+        local found = false
+        for _, line in ipairs(remarks.lines) do
+            for _, remark in ipairs(line.remarks) do
+                if remark.kind == "tag_check" and remark["function"] == "f" then
+                    assert.equals(2, line.line)
+                    assert.equals("argument 'x'", remark.what)
+                    assert.equals("integer", remark.type)
+                    found = true
+                end
+            end
+        end
+        assert.is_true(found)
+    end)
+
     it("Can compile C files", function()
         assert(util.execute("pallenec --emit-c __test__.pln"))
         assert(util.execute("pallenec --compile-c __test__.c"))
@@ -70,6 +314,85 @@ describe("pallenec", function()
         assert(string.find(abort_msg, "Error: option '--emit-lua' can not be used together with option '--emit-c'", nil, true))
     end)
 
+    it("Can compile several files in parallel", function()
+        util.set_file_contents("__test__other__.pln", [[
+            local test = require "__test__"
+            local m: module = {}
+            function m.g(x:integer): integer
+                return test.f(x) * 2
+            end
+            return m
+        ]])
+        util.set_file_contents("__test__script__other__.lua", [[
+            local other = require "__test__other__"
+            print(other.g(1))
+        ]])
+
+        local ok, err = util.execute("pallenec -j 2 __test__other__.pln __test__.pln")
+        local _, _, out, _ = util.outputs_of_execute("lua __test__script__other__.lua")
+        os.remove("__test__other__.pln")
+        os.remove("__test__other__.so")
+        os.remove("__test__other__.d.pln")
+        os.remove("__test__script__other__.lua")
+        assert(ok, err)
+        assert.equals("36\n", out)
+    end)
+
+    it("Can reuse modules from the build cache", function()
+        assert(util.execute("pallenec --cache-dir __test__cache__ __test__.pln"))
+        assert(os.remove("__test__.so"))
+        assert(os.remove("__test__.d.pln"))
+
+        local ok, err = util.execute("pallenec --cache-dir __test__cache__ __test__.pln")
+        local _, _, out, _ = util.outputs_of_execute("lua __test__script__.lua")
+        local _, _, cached, _ = util.outputs_of_execute("ls __test__cache__")
+        util.execute("rm -rf __test__cache__")
+        assert(ok, err)
+        assert.equals("17\n", out)
+        assert(file_exists("__test__.d.pln"))
+        assert.matches("^%x+%.d%.pln\n%x+%.so\n$", cached)
+    end)
+
+    it("Doesn't reuse a cached module that has a different name", function()
+        assert(util.execute(
+            "pallenec --cache-dir __test__cache__ __test__.pln -o __test__flag__.so"))
+        local ok, err = util.execute("pallenec --cache-dir __test__cache__ __test__.pln")
+        local _, _, out, _ = util.outputs_of_execute("lua __test__script__.lua")
+        util.execute("rm -rf __test__cache__")
+        assert(ok, err)
+        assert.equals("17\n", out)
+    end)
+
+    it("Rejects --output with multiple files", function()
+        local ok, err, _, abort_msg = util.outputs_of_execute(
+            "pallenec __test__.pln __test__.pln -o __test__flag__.so")
+        assert.is_false(ok, err)
+        assert(string.find(abort_msg, "can only be used with a single input file", nil, true))
+    end)
+
+    it("Can disable optimization passes", function()
+        assert(util.execute("pallenec -fno-constant-propagation __test__.pln"))
+        local ok, err, out, _ = util.outputs_of_execute("lua __test__script__.lua")
+        assert(ok, err)
+        assert.equals("17\n", out)
+    end)
+
+    it("Rejects unknown passes", function()
+        local ok, err, _, abort_msg =
+            util.outputs_of_execute("pallenec -fno-typechecker __test__.pln")
+        assert.is_false(ok, err)
+        assert(string.find(abort_msg, "unknown option -fno-typechecker", nil, true))
+    end)
+
+    it("Can time the compiler passes", function()
+        local ok, err, _, report = util.outputs_of_execute(
+            "pallenec --time-passes --verify-ir __test__.pln")
+        assert(ok, err)
+        assert.matches("typechecker", report)
+        assert.matches("coder", report)
+        assert.matches("total", report)
+    end)
+
     it("Can extract type declarations", function()
         assert(util.execute("pallenec __test__.pln"))
         assert(file_exists("__test__.d.pln"))
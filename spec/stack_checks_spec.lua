@@ -0,0 +1,61 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local driver = require "pallene.driver"
+local stack_checks = require "pallene.stack_checks"
+
+local function recursive_functions(code)
+    local module, errs = driver.compile_internal("__test__.pln", code, "optimize", 2, {})
+    assert(module, errs and table.concat(errs, "\n"))
+    local is_recursive = stack_checks.recursive_functions(stack_checks.static_callees(module))
+    local names = {}
+    for f_id, func in ipairs(module.functions) do
+        if is_recursive[f_id] then
+            names[func.name] = true
+        end
+    end
+    return names
+end
+
+describe("Stack checks", function()
+
+    it("find directly recursive functions", function()
+        local names = recursive_functions([[
+            local m: module = {}
+            function m.fact(n: integer): integer
+                if n == 0 then return 1 end
+                return n * m.fact(n - 1)
+            end
+            function m.f(n: integer): integer
+                return m.fact(n)
+            end
+            return m
+        ]])
+        assert.are.same({ fact = true }, names)
+    end)
+
+    it("find mutually recursive functions", function()
+        local names = recursive_functions([[
+            local m: module = {}
+            local even, odd
+            function even(n: integer): boolean
+                if n == 0 then return true end
+                return odd(n - 1)
+            end
+            function odd(n: integer): boolean
+                if n == 0 then return false end
+                return even(n - 1)
+            end
+            local function leaf(n: integer): integer
+                return n + 1
+            end
+            function m.f(n: integer): boolean
+                return even(leaf(n))
+            end
+            return m
+        ]])
+        assert.are.same({ even = true, odd = true }, names)
+    end)
+end)
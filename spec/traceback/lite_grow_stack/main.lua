@@ -0,0 +1,18 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local pallene = require "spec.traceback.lite_grow_stack.lite_grow_stack"
+
+-- luacheck: globals error_fn
+function error_fn()
+    error "Error after growing the stack"
+end
+
+-- luacheck: globals wide_fn
+function wide_fn()
+    pallene.call(error_fn)
+end
+
+pallene.call_wide(wide_fn)
@@ -0,0 +1,27 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local pallene = require "spec.traceback.lite_recovery.lite_recovery"
+
+-- luacheck: globals caught
+function caught()
+    error "This error is caught"
+end
+
+-- luacheck: globals uncaught
+function uncaught()
+    error "This error is not caught"
+end
+
+-- luacheck: globals lua_fn
+function lua_fn()
+    -- The caught error leaves the frames of the inner pallene.call behind, and the next call from
+    -- the same place must drop them.
+    local ok = pcall(pallene.call, caught)
+    assert(not ok)
+    pallene.call(uncaught)
+end
+
+pallene.call(lua_fn)
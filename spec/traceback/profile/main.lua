@@ -0,0 +1,9 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local pallene = require "spec.traceback.profile.profile"
+
+-- Long enough for the profiler to take some samples, while the Pallene code is running.
+print(pallene.spin(20000000))
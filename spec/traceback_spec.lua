@@ -5,16 +5,17 @@
 
 local util = require "pallene.util"
 
-local function assert_test(test, expected_traceback)
+local function assert_test(test, expected_traceback, flag)
+    flag = flag or "--use-traceback"
     local plnfile = util.shell_quote("spec/traceback/"..test.."/"..test..".pln")
-    local ok, err = util.execute("pallenec "..plnfile.." --use-traceback")
+    local ok, err = util.execute("pallenec "..plnfile.." "..flag)
     assert(ok, err)
 
     -- Compile the second Pallene file if exists.
     local alt_plnfile = util.shell_quote("spec/traceback/"..test.."/"..test.."_alt.pln")
     local ok, _ = util.execute("test -f "..alt_plnfile)
     if ok then
-        local ok, err = util.execute("pallenec "..alt_plnfile.." --use-traceback")
+        local ok, err = util.execute("pallenec "..alt_plnfile.." "..flag)
         assert(ok, err)
     end
 
@@ -131,3 +132,64 @@ stack traceback:
     C: in function '<?>'
 ]])
 end)
+
+it("Lite tracer, multi-module Lua", function()
+    assert_test("module_lua", [[
+pt-lua: spec/traceback/module_lua/main.lua:N: Any normal error from Lua!
+stack traceback:
+    C: in function 'error'
+    spec/traceback/module_lua/main.lua:N: in function 'lua_3'
+    spec/traceback/module_lua/module_lua.pln:N: in function 'pallene_2'
+    spec/traceback/module_lua/main.lua:N: in function 'lua_2'
+    spec/traceback/module_lua/module_lua.pln:N: in function 'pallene_1'
+    spec/traceback/module_lua/main.lua:N: in function 'callback'
+    ./spec/traceback/module_lua/another_module.lua:N: in function 'call_lua_callback'
+    spec/traceback/module_lua/main.lua:N: in <main>
+    C: in function '<?>'
+]], "--use-lite-traceback")
+end)
+
+it("Lite tracer, frames left behind by a caught error", function()
+    assert_test("lite_recovery", [[
+pt-lua: spec/traceback/lite_recovery/main.lua:N: This error is not caught
+stack traceback:
+    C: in function 'error'
+    spec/traceback/lite_recovery/main.lua:N: in function 'uncaught'
+    spec/traceback/lite_recovery/lite_recovery.pln:N: in function 'call'
+    spec/traceback/lite_recovery/main.lua:N: in function 'lua_fn'
+    spec/traceback/lite_recovery/lite_recovery.pln:N: in function 'call'
+    spec/traceback/lite_recovery/main.lua:N: in <main>
+    C: in function '<?>'
+]], "--use-lite-traceback")
+end)
+
+it("Lite tracer, entry point that grows the stack", function()
+    assert_test("lite_grow_stack", [[
+pt-lua: spec/traceback/lite_grow_stack/main.lua:N: Error after growing the stack
+stack traceback:
+    C: in function 'error'
+    spec/traceback/lite_grow_stack/main.lua:N: in function 'error_fn'
+    spec/traceback/lite_grow_stack/lite_grow_stack.pln:N: in function 'call'
+    spec/traceback/lite_grow_stack/main.lua:N: in function 'wide_fn'
+    spec/traceback/lite_grow_stack/lite_grow_stack.pln:N: in function 'call_wide'
+    spec/traceback/lite_grow_stack/main.lua:N: in <main>
+    C: in function '<?>'
+]], "--use-lite-traceback")
+end)
+
+it("Profiler", function()
+    local ok, err = util.execute("pallenec spec/traceback/profile/profile.pln --use-traceback")
+    assert(ok, err)
+
+    local folded = os.tmpname()
+    local ok, err = util.outputs_of_execute(
+        "env PT_PROFILE="..util.shell_quote(folded).." pt-lua spec/traceback/profile/main.lua")
+    assert(ok, err)
+    local profile = assert(util.get_file_contents(folded))
+    os.remove(folded)
+
+    -- The samples are taken while spin runs, but the Lua frames are only added after it returns.
+    local main_fn = "<main> %(spec/traceback/profile/main%.lua:0%)"
+    local spin_fn = "spin %(spec/traceback/profile/profile%.pln%)"
+    assert.truthy(string.match(profile, main_fn..";"..spin_fn.." %d+\n"), profile)
+end)
@@ -0,0 +1,53 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local driver = require "pallene.driver"
+local translation_units = require "pallene.translation_units"
+
+local function partition(code, n_units)
+    local module, errs = driver.compile_internal("__test__.pln", code, "optimize", 2, {})
+    assert(module, errs and table.concat(errs, "\n"))
+    local unit_of = {}
+    for i, f_ids in ipairs(translation_units.partition(module, n_units)) do
+        for _, f_id in ipairs(f_ids) do
+            assert.falsy(unit_of[f_id])
+            unit_of[f_id] = i
+        end
+    end
+    local unit_of_name = {}
+    for f_id, func in ipairs(module.functions) do
+        assert.truthy(unit_of[f_id])
+        unit_of_name[func.name] = unit_of[f_id]
+    end
+    return unit_of_name
+end
+
+describe("Translation units", function()
+
+    it("keep functions that call each other together", function()
+        local unit_of = partition([[
+            local m: module = {}
+            local function a(x: integer): integer return x + 1 end
+            local function b(x: integer): integer return a(x) * 2 end
+            local function c(x: integer): integer return x - 1 end
+            local function d(x: integer): integer return c(x) * 3 end
+            function m.f(x: integer): integer return x end
+            return m
+        ]], 3)
+        assert.equals(unit_of["a"], unit_of["b"])
+        assert.equals(unit_of["c"], unit_of["d"])
+    end)
+
+    it("do not create empty units", function()
+        local unit_of = partition([[
+            local m: module = {}
+            function m.f(x: integer): integer return x end
+            return m
+        ]], 10)
+        for _, unit in pairs(unit_of) do
+            assert.truthy(unit <= 2)
+        end
+    end)
+end)
@@ -34,6 +34,13 @@ describe("Pallene utils", function()
         os.remove(filename)
     end)
 
+    it("writes to an in-memory buffer", function()
+        local buffer = util.StringBuffer.new()
+        buffer:write("a", "b")
+        buffer:write("c")
+        assert.equals("abc", buffer:tostring())
+    end)
+
     it("can extract stdout from commands", function()
          local cmd = [[lua -e 'io.stdout:write("hello")']]
          local ok, err, stdout, stderr = util.outputs_of_execute(cmd)
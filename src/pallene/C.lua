@@ -11,6 +11,7 @@
 -- is simpler than trying to generate indented things right out of the gate.
 
 local re = require "re"
+local util = require "pallene.util"
 
 local C = {}
 
@@ -131,8 +132,10 @@ local function count_braces(line)
     return n
 end
 
--- This function reformats a string corresponding to a C source file. It allows us to produce
--- readable C output without having to worry about indentation while we are generating it.
+-- A Formatter reformats C source code, and writes the result to an output stream. It allows us to
+-- produce readable C output without having to worry about indentation while we are generating it.
+-- Since the formatter only needs to remember the current indentation depth, we can generate a large
+-- C file a piece at a time, without ever having the whole file in memory.
 --
 -- The algorithm is not very clever, so you must follow some rules if you want to get good-looking
 -- results:
@@ -140,10 +143,20 @@ end
 --   * Use braces on if statements, while loops, and for loops.
 --   * /**/-style comments must not span multiple lines
 --   * goto labels must appear on a line by themselves
+--   * Each piece of code that is passed to the formatter must consist of whole lines.
 --
-function C.reformat(input)
-    local out = {}
-    local depth = 0
+
+local Formatter = util.Class()
+C.Formatter = Formatter
+
+-- @param output: A file handle, or any other object with a compatible write method.
+function Formatter:init(output)
+    self.output = output
+    self.depth = 0
+end
+
+function Formatter:write(input)
+    local output = self.output
     for line in input:gmatch("([^\n]*)") do
         line = line:match("^%s*(.-)%s*$")
 
@@ -154,22 +167,31 @@ function C.reformat(input)
 
         elseif line:match("^[A-Za-z_][A-Za-z_0-9]*:$") then
             -- Labels are indented halfway
-            nspaces = math.max(0, 4*depth - 2)
+            nspaces = math.max(0, 4*self.depth - 2)
 
         else
             -- Regular lines are indented based on {} and ().
             local unindent_this_line = string.match(line, "^[})]")
-            nspaces = 4 * (depth - (unindent_this_line and 1 or 0))
-            depth = depth + count_braces(line)
-            assert(depth >= 0, "Unbalanced indentation. Too many '}'s")
+            nspaces = 4 * (self.depth - (unindent_this_line and 1 or 0))
+            self.depth = self.depth + count_braces(line)
+            assert(self.depth >= 0, "Unbalanced indentation. Too many '}'s")
         end
 
-        table.insert(out, string.rep(" ", nspaces))
-        table.insert(out, line)
-        table.insert(out, "\n")
+        output:write(string.rep(" ", nspaces), line, "\n")
     end
-    assert(depth == 0, "Unbalanced indentation at end of file.")
-    return table.concat(out)
+end
+
+function Formatter:finish()
+    assert(self.depth == 0, "Unbalanced indentation at end of file.")
+end
+
+-- Reformats a string corresponding to a whole C source file. See the Formatter class.
+function C.reformat(input)
+    local buffer = util.StringBuffer.new()
+    local formatter = Formatter.new(buffer)
+    formatter:write(input)
+    formatter:finish()
+    return buffer:tostring()
 end
 
 return C
@@ -0,0 +1,101 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- DENSE BITSETS
+-- =============
+-- Sets of positive integers, represented as arrays of 64-bit words. Compared to a Lua table used as
+-- a set, these use much less memory, and unions and intersections run a whole word at a time. They
+-- are meant for the flow analyses, where the elements are variable ids or other small integers.
+--
+-- All the bitsets that are combined together must have been created with the same number of words.
+-- Element v is stored in the bit (v-1) % 64 of the word (v-1) // 64 + 1.
+
+local bitset = {}
+
+-- Number of words needed for a bitset that can contain the numbers from 1 to [max_value].
+function bitset.nwords(max_value)
+    return (max_value + 63) // 64
+end
+
+function bitset.new(nwords)
+    local bs = {}
+    for i = 1, nwords do
+        bs[i] = 0
+    end
+    return bs
+end
+
+function bitset.add(bs, v)
+    local w = ((v - 1) >> 6) + 1
+    bs[w] = bs[w] | (1 << ((v - 1) & 63))
+end
+
+function bitset.remove(bs, v)
+    local w = ((v - 1) >> 6) + 1
+    bs[w] = bs[w] & ~(1 << ((v - 1) & 63))
+end
+
+function bitset.contains(bs, v)
+    local w = ((v - 1) >> 6) + 1
+    local word = bs[w]
+    return word ~= nil and (word & (1 << ((v - 1) & 63))) ~= 0
+end
+
+-- Converts a Lua set, that is, a table whose keys are the elements.
+function bitset.from_set(set, nwords)
+    local bs = bitset.new(nwords)
+    for v, _ in pairs(set) do
+        bitset.add(bs, v)
+    end
+    return bs
+end
+
+-- Adds all the elements of [src] to [dst]. Returns whether [dst] changed.
+function bitset.union_into(dst, src)
+    local changed = false
+    for i = 1, #dst do
+        local old = dst[i]
+        local new = old | src[i]
+        if new ~= old then
+            dst[i] = new
+            changed = true
+        end
+    end
+    return changed
+end
+
+-- To find the index of the lowest bit that is set in a word, we isolate that bit and then use a
+-- de Bruijn sequence to map it to a unique 6-bit number. (Integer multiplication wraps around.)
+local DEBRUIJN = 0x03f79d71b4cb0a89
+local bit_index = {} -- { debruijn_hash => bit }
+for b = 0, 63 do
+    bit_index[(((1 << b) * DEBRUIJN) >> 58) + 1] = b
+end
+
+-- Returns the elements, in increasing order.
+function bitset.elements(bs)
+    local out = {}
+    for i = 1, #bs do
+        local word = bs[i]
+        local base = (i - 1) * 64 + 1
+        while word ~= 0 do
+            local lowest = word & -word
+            out[#out + 1] = base + bit_index[((lowest * DEBRUIJN) >> 58) + 1]
+            word = word ~ lowest
+        end
+    end
+    return out
+end
+
+-- Converts back to a Lua set.
+function bitset.to_set(bs)
+    local set = {}
+    for _, v in ipairs(bitset.elements(bs)) do
+        set[v] = true
+    end
+    return set
+end
+
+return bitset
@@ -0,0 +1,183 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- BUILD CACHE
+-- ===========
+-- A content-addressed cache for compiled Pallene modules. Each entry is keyed by a hash of
+-- everything that can influence the output of `pallenec foo.pln`:
+--
+--   * the contents of foo.pln
+--   * the name of the module, which is part of the name of its luaopen function
+--   * the contents of the .d.pln type files of the modules that foo.pln requires
+--   * the source code of the Pallene compiler itself
+--   * the optimization level and the other compiler flags
+--   * the C compiler and its flags
+--
+-- An entry consists of two files in the cache directory, <key>.so and <key>.d.pln. We only ever
+-- write complete entries (using a rename), so it is safe to share a cache directory between
+-- several concurrent pallenec processes.
+
+local c_compiler = require "pallene.c_compiler"
+local util = require "pallene.util"
+
+local build_cache = {}
+
+-- The directory used if the user did not pass one in the command line.
+function build_cache.default_dir()
+    return os.getenv("PALLENE_CACHE_DIR")
+end
+
+local compiler_fingerprint = false
+
+-- Hash of the source code of every Pallene module that is currently loaded. We use this instead of
+-- a version number, so that the cache does not get confused while we are hacking on the compiler.
+local function get_compiler_fingerprint()
+    if not compiler_fingerprint then
+        local names = {}
+        for name in pairs(package.loaded) do
+            if string.match(name, "^pallene%.") then
+                table.insert(names, name)
+            end
+        end
+        table.sort(names)
+
+        local parts = {}
+        for _, name in ipairs(names) do
+            local path = package.searchpath(name, package.path)
+            local contents = path and util.get_file_contents(path)
+            table.insert(parts, name)
+            table.insert(parts, contents or "")
+        end
+        compiler_fingerprint = util.hash_string(table.concat(parts, "\0"))
+    end
+    return compiler_fingerprint
+end
+
+-- The modules that a Pallene program imports with `require`. We only need the AST for this.
+function build_cache.required_modules(file_name, input)
+    -- Required here to avoid a circular dependency with the driver.
+    local driver = require "pallene.driver"
+    local prog_ast, errs = driver.compile_internal(file_name, input, "ast")
+    if not prog_ast then
+        return false, errs
+    end
+
+    local module_names = {}
+    for _, tl in ipairs(prog_ast.tls) do
+        if tl._tag == "ast.Toplevel.Require" and tl.module_name_exp._tag == "ast.Exp.String" then
+            table.insert(module_names, tl.module_name_exp.value)
+        end
+    end
+    table.sort(module_names)
+    return module_names, {}
+end
+
+--
+-- Computes the cache key for compiling [file_name] into a shared library for the module
+-- [mod_name]. The module name comes from the output file, not from the input file.
+-- Returns false if the key cannot be computed, for example because of a syntax error.
+-- In that case the file should be compiled normally, so that the user gets the error message.
+--
+function build_cache.key(file_name, mod_name, opt_level, flags)
+    -- The profiles live outside of the cache and change every time the workload runs.
+    if flags.pgo_generate or flags.pgo_use then
+        return false
+    end
+
+    local input = util.get_file_contents(file_name)
+    if not input then
+        return false
+    end
+
+    local module_names = build_cache.required_modules(file_name, input)
+    if not module_names then
+        return false
+    end
+
+    local parts = {
+        "pallene build cache v1",
+        get_compiler_fingerprint(),
+        c_compiler.configuration(),
+        "-O" .. tostring(opt_level),
+        flags.use_traceback and "--use-traceback" or "",
+        flags.traceback_lite and "--use-lite-traceback" or "",
+        flags.instrument and "--instrument" or "",
+        flags.instrument_allocs and "--instrument-allocs" or "",
+        flags.instrument_checks and "--instrument-checks" or "",
+        flags.batch_entry_points and "--batch-entry-points" or "",
+        flags.lto and "--lto" or "",
+        "--split-units=" .. tostring(flags.split_units or 1),
+        table.concat(flags.disabled_pass_list or {}, ","),
+        file_name,
+        mod_name,
+        input,
+    }
+    for _, module_name in ipairs(module_names) do
+        -- A missing type file is part of the key too: once it appears, the key changes.
+        local d_pln = util.get_file_contents(module_name .. ".d.pln")
+        table.insert(parts, module_name)
+        table.insert(parts, d_pln or "")
+    end
+
+    return util.hash_string(table.concat(parts, "\0"))
+end
+
+local function copy_file(src, dst)
+    local contents, err = util.get_file_contents(src)
+    if not contents then
+        return false, err
+    end
+    -- Write to a temporary file first, so that nobody ever sees a half-written file.
+    local tmp = string.format("%s.tmp%08x", dst, math.random(0, 0x7fffffff))
+    local ok
+    ok, err = util.set_file_contents(tmp, contents)
+    if not ok then
+        os.remove(tmp)
+        return false, err
+    end
+    ok, err = os.rename(tmp, dst)
+    if not ok then
+        os.remove(tmp)
+        return false, err
+    end
+    return true
+end
+
+local function entry_paths(cache_dir, key)
+    local prefix = cache_dir .. "/" .. key
+    return prefix .. ".so", prefix .. ".d.pln"
+end
+
+--
+-- If the cache has an entry for [key], copy it to [so_name] and [d_pln_name] and return true.
+--
+function build_cache.fetch(cache_dir, key, so_name, d_pln_name)
+    local cached_so, cached_d_pln = entry_paths(cache_dir, key)
+    local f = io.open(cached_d_pln, "r")
+    if not f then
+        return false
+    end
+    f:close()
+    return copy_file(cached_so, so_name) and copy_file(cached_d_pln, d_pln_name) or false
+end
+
+--
+-- Add the freshly compiled [so_name] and [d_pln_name] to the cache. The .d.pln file is written
+-- last because fetch uses it to tell whether an entry is complete.
+--
+function build_cache.store(cache_dir, key, so_name, d_pln_name)
+    local ok, err = util.execute("mkdir -p " .. util.shell_quote(cache_dir))
+    if not ok then
+        return false, err
+    end
+    local cached_so, cached_d_pln = entry_paths(cache_dir, key)
+    ok, err = copy_file(so_name, cached_so)
+    if not ok then
+        return false, err
+    end
+    return copy_file(d_pln_name, cached_d_pln)
+end
+
+return build_cache
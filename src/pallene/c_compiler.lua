@@ -32,36 +32,158 @@ else
     CFLAGS_SHARED = "-shared"
 end
 
+-- A description of the C compiler and flags that we are going to use. Anything that could change
+-- the generated object code should be in here, because it is part of the build cache key.
+function c_compiler.configuration()
+    return table.concat({ CC, CFLAGS, CFLAGS_SHARED }, " ")
+end
+
+local function compiler_failed(cmd)
+    return false, {
+        "internal error: compiler failed",
+        "compilation line: " .. cmd,
+    }
+end
+
 local function run_cc(args)
     local cmd = CC .. " " .. table.concat(args, " ")
     local ok = util.execute(cmd)
     if not ok then
+        return compiler_failed(cmd)
+    end
+    return true, {}
+end
+
+-- Flags that depend on the pallenec command-line options.
+local function extra_flags(flags)
+    local out = {}
+    if flags and flags.lto then
+        table.insert(out, "-flto")
+    end
+    if flags and flags.pgo_generate then
+        table.insert(out, util.shell_quote("-fprofile-generate=" .. flags.pgo_generate))
+    end
+    if flags and flags.pgo_use then
+        table.insert(out, util.shell_quote("-fprofile-use=" .. flags.pgo_use))
+    end
+    return table.concat(out, " ")
+end
+
+local is_clang = nil
+local function cc_is_clang()
+    if is_clang == nil then
+        local ok, _, out = util.outputs_of_execute(CC .. " --version")
+        is_clang = ok and string.find(out, "clang", 1, true) ~= nil
+    end
+    return is_clang
+end
+
+-- GCC reads its .gcda profile files directly, but Clang wants us to merge the raw profiles that the
+-- instrumented program wrote into a single default.profdata file.
+function c_compiler.merge_profiles(dir)
+    if not cc_is_clang() then
+        return true, {}
+    end
+
+    local qdir = util.shell_quote(dir)
+    if not util.execute("ls " .. qdir .. "/*.profraw > /dev/null 2>&1") then
+        return true, {}
+    end
+
+    local profdata = os.getenv("LLVM_PROFDATA") or "llvm-profdata"
+    local cmd = string.format("%s merge -output=%s/default.profdata %s/*.profraw",
+        profdata, qdir, qdir)
+    if not util.execute(cmd) then
         return false, {
-            "internal error: compiler failed",
-            "compilation line: " .. cmd,
+            "internal error: could not merge the profile data",
+            "command line: " .. cmd,
         }
     end
     return true, {}
 end
 
-function c_compiler.compile_c_to_o(in_filename, out_filename)
+function c_compiler.compile_c_to_o(in_filename, out_filename, _mod_name, _opt_level, flags)
     return run_cc({
         "-fPIC",
         CFLAGS,
+        extra_flags(flags),
         "-x c",
         "-o", util.shell_quote(out_filename),
         "-c", util.shell_quote(in_filename),
     })
 end
 
-function c_compiler.compile_o_to_so(in_filename, out_filename)
+function c_compiler.compile_o_to_so(in_filename, out_filename, _mod_name, _opt_level, flags)
     -- There is no need to add the '-x' flag when compiling an object file without a '.o' extension.
     -- According to GCC, any file name with no recognized suffix is treated as an object file.
     return run_cc({
         CFLAGS_SHARED,
+        extra_flags(flags),
         "-o", util.shell_quote(out_filename),
         util.shell_quote(in_filename),
     })
 end
 
+-- Compile several C files in parallel, and then link them into a single shared library. This is
+-- used when we split a module into several translation units. See translation_units.lua
+function c_compiler.compile_units_to_so(c_filenames, o_filenames, out_filename, njobs, flags)
+    local cmds = {}
+    for i, c_filename in ipairs(c_filenames) do
+        cmds[i] = CC .. " " .. table.concat({
+            "-fPIC",
+            CFLAGS,
+            extra_flags(flags),
+            "-x c",
+            "-o", util.shell_quote(o_filenames[i]),
+            "-c", util.shell_quote(c_filename),
+        }, " ")
+    end
+
+    local failed_cmd = false
+    for i, result in ipairs(util.execute_parallel(cmds, njobs)) do
+        io.stderr:write(result.output)
+        if not result.ok and not failed_cmd then
+            failed_cmd = cmds[i]
+        end
+    end
+    if failed_cmd then
+        return compiler_failed(failed_cmd)
+    end
+
+    local quoted_o_filenames = {}
+    for i, o_filename in ipairs(o_filenames) do
+        quoted_o_filenames[i] = util.shell_quote(o_filename)
+    end
+    return run_cc({
+        CFLAGS_SHARED,
+        extra_flags(flags),
+        "-o", util.shell_quote(out_filename),
+        table.concat(quoted_o_filenames, " "),
+    })
+end
+
+-- Compile and link C source code in a single compiler invocation. The code is sent through a pipe
+-- to the compiler's stdin, so we don't need to create any temporary files. The write_c_code
+-- callback receives the pipe, and writes the C code into it.
+function c_compiler.compile_c_code_to_so(write_c_code, out_filename, flags)
+    local cmd = CC .. " " .. table.concat({
+        "-fPIC",
+        CFLAGS,
+        CFLAGS_SHARED,
+        extra_flags(flags),
+        "-o", util.shell_quote(out_filename),
+        "-x c", "-",
+    }, " ")
+
+    local pipe = io.popen(cmd, "w")
+    if not pipe then
+        return compiler_failed(cmd)
+    end
+    write_c_code(pipe)
+    if not pipe:close() then
+        return compiler_failed(cmd)
+    end
+    return true, {}
+end
+
 return c_compiler
@@ -14,6 +14,8 @@ local C = require "pallene.C"
 local gc = require "pallene.gc"
 local ir = require "pallene.ir"
 local pallenelib = require "pallene.pallenelib"
+local pgo = require "pallene.pgo"
+local stack_checks = require "pallene.stack_checks"
 local types = require "pallene.types"
 local util = require "pallene.util"
 
@@ -23,10 +25,59 @@ local define_union = tagged_union.in_namespace(coder, "coder")
 local Coder
 local RecordCoder
 
+-- Writes the C code to [output], which can be a file handle or anything else with a compatible
+-- write method. The code is generated and written one function at a time, so the memory usage is
+-- proportional to the size of the largest function, instead of the size of the whole module.
+function coder.generate_to(output, module, modname, pallene_filename, flags)
+    local c = Coder.new(module, modname, pallene_filename, flags)
+    c:generate_module(output)
+    return true, {}
+end
+
 function coder.generate(module, modname, pallene_filename, flags)
+    local buffer = util.StringBuffer.new()
+    coder.generate_to(buffer, module, modname, pallene_filename, flags)
+    return buffer:tostring(), {}
+end
+
+-- Like coder.generate_to, but distributes the functions over several translation units, which
+-- share an internal header. [units] is the output of translation_units.partition, and
+-- [unit_outputs] must have one output stream for each unit. The first unit is the one that should
+-- define the luaopen function. The units refer to the header by the name [header_name].
+function coder.generate_units_to(header_output, unit_outputs, header_name, units,
+                                 module, modname, pallene_filename, flags)
+    assert(#unit_outputs == #units)
     local c = Coder.new(module, modname, pallene_filename, flags)
-    local code = c:generate_module_header() .. c:generate_module_body()
-    return code, {}
+    c:generate_units(header_output, unit_outputs, header_name, units)
+    return true, {}
+end
+
+-- Optimization remarks, for pallenec --remarks. They tell which runtime checks and which garbage
+-- collector bookkeeping remain in the generated C code, grouped by source line. To be sure that
+-- they match the C code, we collect them while generating it, and then throw the code away.
+function coder.remarks(module, modname, pallene_filename, flags)
+    local c = Coder.new(module, modname, pallene_filename, flags)
+    c.remarks = {}
+    c:generate_module({ write = function() end })
+
+    local by_line = {} -- { line => { remark } }
+    local lines = {}
+    for _, remark in ipairs(c.remarks) do
+        local line = remark.line
+        if not by_line[line] then
+            by_line[line] = {}
+            table.insert(lines, line)
+        end
+        remark.line = nil
+        table.insert(by_line[line], remark)
+    end
+    table.sort(lines)
+
+    local result = {}
+    for _, line in ipairs(lines) do
+        table.insert(result, { line = line, remarks = by_line[line] })
+    end
+    return { file = pallene_filename, lines = result }
 end
 
 -- This helper function concatenates a list of lines, which may or may not be terminated with "\n".
@@ -75,10 +126,25 @@ function Coder:init(module, modname, filename, flags)
     self.flags = flags
 
     self.current_func = false
+    self.current_f_id = false
+
+    self.remarks = false -- { table }, when collecting them for coder.remarks
+
+    -- The cold data of the tag checks. See Coder:get_stack_slot.
+    self.tag_check_sites = {}       -- { { file, line, expected_type, description } }
+    self.tag_check_site_of_key = {} -- string => integer (0-based)
+
+    -- Counted runtime checks, for --instrument-checks. See Coder:count_check.
+    self.check_sites = {} -- { { func = string, kind = string, line = integer, what = string } }
+
+    -- Storage class of the generated functions. They are only visible to the other translation
+    -- units of the same module if we split it. See Coder:generate_units.
+    self.linkage = "static"
 
     self.constants = {} -- { coder.Constant }
     self.k_slot_of_metatable = {} -- typ  => integer
     self.k_slot_of_string    = {} -- str  => integer
+    self.k_slot_of_closure   = {} -- f_id => integer
     self:init_upvalues()
 
     self.record_ids    = {}      -- types.T.Record => integer
@@ -88,9 +154,43 @@ function Coder:init(module, modname, filename, flags)
         self.record_coders[typ] = RecordCoder.new(self, typ)
     end
 
-    self.gc = {} -- { func => gc_info } see gc.compute_gc_info
+    self.gc_func = false -- The function that self.gc_info refers to
+    self.gc_info = false -- See gc.compute_gc_info
+    self.gc_info_of = {} -- func => GC info that Coder:max_frame_size computed ahead of time
+    self.max_frame_size_of = {} -- func => integer
     self.max_lua_call_stack_usage = {} -- func => integer
     self:init_gc()
+
+    -- Where we check for free stack space. See stack_checks.lua
+    self.static_callees = stack_checks.static_callees(module)
+    self.is_recursive = stack_checks.recursive_functions(self.static_callees)
+    self.slots_needed_of = {} -- f_id => integer
+
+    -- Exported functions that also get a batch entry point, for --batch-entry-points
+    self.has_batch_entry_point = {} -- f_id => boolean
+    if self.flags.batch_entry_points then
+        for _, f_id in ipairs(module.exported_functions) do
+            if #module.functions[f_id].typ.arg_types > 0 then
+                self.has_batch_entry_point[f_id] = true
+            end
+        end
+    end
+
+    -- Profile counters, for --pgo-generate
+    self.pgo_offsets = false -- { f_id => integer }
+    self.pgo_n_counters = 0
+    self.pgo_shape_hash = false
+    if self.flags.pgo_generate then
+        self.pgo_offsets, self.pgo_n_counters, self.pgo_shape_hash = pgo.counter_layout(module)
+    end
+
+    -- Allocation sites, for --instrument-allocs
+    self.alloc_sites = {}   -- { { f_id = integer, kind = string, line = integer } }
+    self.alloc_site_of = {} -- ir.Cmd => integer
+    self.gc_site_of = {}    -- func => block_i => cmd_i => integer
+    if self.flags.instrument_allocs then
+        self:init_alloc_sites()
+    end
 end
 
 --
@@ -251,6 +351,35 @@ end
 --                  Received as serialized C expressions.
 --
 
+-- The description of a tag check, for the error message and the remarks. The extra arguments are C
+-- literals, either integers or strings without escape sequences.
+local function describe(description_fmt, extra_args)
+    local i = 0
+    return (string.gsub(description_fmt, "%%[sd]", function()
+        i = i + 1
+        return (string.gsub(extra_args[i], '^"(.*)"$', "%1"))
+    end))
+end
+
+-- @returns the index of the tag check site in pallene_tag_check_sites. Identical sites are shared.
+function Coder:tag_check_site(loc, expected_type, description)
+    local file = loc and loc.file_name or "<anonymous>"
+    local line = loc and loc.line or 0
+    local key = string.format("%s:%d:%s:%s", file, line, expected_type, description)
+    local i = self.tag_check_site_of_key[key]
+    if not i then
+        table.insert(self.tag_check_sites, {
+            file = file,
+            line = line,
+            expected_type = expected_type,
+            description = description,
+        })
+        i = #self.tag_check_sites - 1
+        self.tag_check_site_of_key[key] = i
+    end
+    return i
+end
+
 function Coder:get_stack_slot(typ, dst, slot, loc, description_fmt, ...)
 
     local cmds = {}
@@ -265,24 +394,22 @@ function Coder:get_stack_slot(typ, dst, slot, loc, description_fmt, ...)
 
         local setline = string.format("PALLENE_SETLINE(%s);", C.integer(loc.line))
 
+        local what = describe(description_fmt, extra_args)
+        self:remark(loc, "tag_check", { what = what, type = pallene_type_tag(typ) })
 
         table.insert(cmds, util.render([[
+            ${count_check}
             if (l_unlikely(!$test)) {
                 ${setline}
-                pallene_runtime_tag_check_error(L,
-                    $file, $line, $expected_type, $slot,
-                    ${description_fmt}${opt_comma}${extra_args});
+                pallene_tag_check_failed(L, $site, $slot);
             }
         ]], {
+            count_check = self:count_check(loc, "tag_check",
+                string.format("%s (%s)", what, pallene_type_tag(typ))),
             test = self:test_tag(typ, slot),
             setline = setline,
-            file = C.string(loc and loc.file_name or "<anonymous>"),
-            line = C.integer(loc and loc.line or 0),
-            expected_type = C.string(pallene_type_tag(typ)),
+            site = C.integer(self:tag_check_site(loc, pallene_type_tag(typ), what)),
             slot = slot,
-            description_fmt = C.string(description_fmt),
-            opt_comma = (#extra_args == 0 and "" or ", "),
-            extra_args = table.concat(extra_args, ", "),
         }))
     end
 
@@ -305,11 +432,14 @@ function Coder:get_luatable_slot(typ, dst, slot, tab, loc, description_fmt, ...)
     -- Lua calls the __index metamethod when it reads from an empty field. We want to avoid that in
     -- Pallene, so we raise an error instead.
     if typ._tag == "types.T.Any" or typ._tag == "types.T.Nil" then
+        self:remark(loc, "metatable_check", { what = description_fmt })
         table.insert(parts, util.render([[
             if (isempty($slot)) {
+                ${count_check}
                 ${check_no_metatable}
             }
         ]], {
+            count_check = self:count_check(loc, "metatable_check", description_fmt),
             slot = slot,
             check_no_metatable = check_no_metatable(self, tab, loc),
         }))
@@ -341,6 +471,36 @@ function Coder:c_var(v_id)
     return "x" .. v_id
 end
 
+-- @returns the name of the variable v_id in the source code, if it has one
+function Coder:var_name(v_id)
+    return self.current_func.vars[v_id].name or self:c_var(v_id)
+end
+
+-- Counts how many times a runtime check runs, for --instrument-checks. Each call creates a new
+-- counter, so it must be called only once per check that we emit. See generate_checks_function.
+function Coder:count_check(loc, kind, what)
+    if not self.flags.instrument_checks then return "" end
+    local func = self.current_func
+    table.insert(self.check_sites, {
+        func = func.name,
+        kind = kind,
+        line = (loc and loc.line) or (func.loc and func.loc.line) or 0,
+        what = what,
+    })
+    return string.format("pallene_check_counts[%s]++;", C.integer(#self.check_sites - 1))
+end
+
+-- Adds a remark about the current function to self.remarks, if we are collecting them. See
+-- coder.remarks.
+function Coder:remark(loc, kind, fields)
+    if not self.remarks then return end
+    local func = self.current_func
+    fields.kind = kind
+    fields["function"] = func.name
+    fields.line = (loc and loc.line) or (func.loc and func.loc.line) or 0
+    table.insert(self.remarks, fields)
+end
+
 -- @returns the C parameter name for the upvalue u_id
 function Coder:c_upval(u_id)
     assert(self.current_func)
@@ -442,9 +602,10 @@ function Coder:pallene_entry_point_declaration(f_id)
     end
 
     return (util.render([[
-        static ${ret_type} ${name}(
+        ${linkage} ${ret_type} ${name}(
             ${args}
         )]], { -- no whitespace after ")"
+            linkage = self.linkage,
             ret_type = ret_type,
             name = self:pallene_entry_point_name(f_id),
             args = concat_lines(arg_lines),
@@ -456,6 +617,7 @@ function Coder:pallene_entry_point_definition(f_id)
     local arg_types = func.typ.arg_types
 
     self.current_func = func
+    self.current_f_id = f_id
 
     local parts = {}
 
@@ -480,24 +642,18 @@ function Coder:pallene_entry_point_definition(f_id)
     --
 
     do
-        local max_frame_size = self.gc[func].max_frame_size
-        local slots_needed = max_frame_size + self.max_lua_call_stack_usage[func]
         local linenum = func.loc and func.loc.line or 0
 
         local frameenter = string.format("PALLENE_C_FRAMEENTER(%s);", C.string(func.name))
         local setline = string.format("PALLENE_SETLINE(%s);", C.integer(linenum))
 
         table.insert(parts, frameenter)
-        if slots_needed > 0 then
-            table.insert(parts, util.render([[
-                if (!lua_checkstack(L, $n)) {
-                    ${setline}
-                    pallene_runtime_cant_grow_stack_error(L);
-                }
-            ]], {
-                n = C.integer(slots_needed),
-                setline = setline,
-            }))
+        if self.flags.instrument then
+            table.insert(parts, "PALLENE_STATS_ENTER();")
+        end
+        if self.is_recursive[f_id] then
+            -- The other functions are covered by the check in their Lua entry point.
+            table.insert(parts, self:stack_check(self:stack_slots_needed(f_id), setline))
         end
         table.insert(parts, "StackValue *base = L->top.p;");
         table.insert(parts, self:savestack())
@@ -536,6 +692,10 @@ function Coder:pallene_entry_point_definition(f_id)
                 util.render([[ *$reti = $v; ]], { reti = self:c_ret_var(i), v = var }))
         end
 
+        table.insert(parts, "PALLENE_FRAMEEXIT();")
+        if self.flags.instrument then
+            table.insert(parts, self:stats_exit(f_id, "calls", "time", "self_time"))
+        end
         if #func.ret_vars > 0 then
             table.insert(parts, "return " .. self:c_var(func.ret_vars[1]) .. ";")
         else
@@ -598,7 +758,8 @@ function Coder:lua_entry_point_name(f_id)
 end
 
 function Coder:lua_entry_point_declaration(f_id)
-    return (util.render([[static int ${name}(lua_State *L)]], {
+    return (util.render([[${linkage} int ${name}(lua_State *L)]], {
+        linkage = self.linkage,
         name = self:lua_entry_point_name(f_id)
     }))
 end
@@ -610,12 +771,16 @@ function Coder:lua_entry_point_definition(f_id)
     local ret_types = func.typ.ret_types
 
     self.current_func = func
+    self.current_f_id = f_id
 
     local parts = {}
 
     -- 0) Function declaration
     table.insert(parts, self:lua_entry_point_declaration(f_id))
     table.insert(parts, "{")
+    if self.flags.instrument then
+        table.insert(parts, "PALLENE_STATS_ENTER();")
+    end
 
     -- 1) Adjust input arguments
     --
@@ -700,6 +865,13 @@ function Coder:lua_entry_point_definition(f_id)
     end
 
     -- 5) Call the Pallene entry point
+    --
+    -- We don't use `base` after the stack check, because the stack may have been reallocated.
+
+    local stack_check = self:entry_stack_check(f_id)
+    if stack_check ~= "" then
+        table.insert(parts, stack_check)
+    end
 
     local ret_vars  = {}
     for i, typ in ipairs(ret_types) do
@@ -720,11 +892,154 @@ function Coder:lua_entry_point_definition(f_id)
         table.insert(parts, self:push_to_stack(typ, ret_vars[i]))
     end
 
+    if self.flags.use_traceback then
+        table.insert(parts, "PALLENE_LUA_FRAMEEXIT();")
+    end
+    if self.flags.instrument then
+        table.insert(parts, self:stats_exit(f_id, "lua_calls", "lua_time", "boundary_time"))
+    end
     table.insert(parts, string.format("return %s;", C.integer(#ret_types)))
     table.insert(parts, "}")
     return concat_lines(parts)
 end
 
+--
+-- # Batch entry point
+--
+-- With --batch-entry-points, each exported function that has parameters also gets an entry point
+-- that calls it over whole arrays. It takes an array for each parameter and an array for each
+-- return value, and calls the function once for each element of the first array:
+--
+--     foo.__pallene_batch.f(xs, ys, out) -- out[i] = foo.f(xs[i], ys[i]), for i = 1, #xs
+--
+-- This way, a Lua program that calls a small Pallene function many times only pays for the arity
+-- check, the constant table and the stack check once. Inside the loop, only the elements are type
+-- checked. The only upvalue of a batch entry point is the closure of the exported function, which
+-- has the upvalues that the Pallene entry point needs.
+
+function Coder:batch_entry_point_name(f_id)
+    return string.format("function_%02d_batch", f_id)
+end
+
+function Coder:batch_entry_point_declaration(f_id)
+    return (util.render([[${linkage} int ${name}(lua_State *L)]], {
+        linkage = self.linkage,
+        name = self:batch_entry_point_name(f_id)
+    }))
+end
+
+function Coder:batch_entry_point_definition(f_id)
+    local func = self.module.functions[f_id]
+    local arg_types = func.typ.arg_types
+    local ret_types = func.typ.ret_types
+    local n_arrays = #arg_types + #ret_types
+
+    self.current_func = func
+    self.current_f_id = f_id
+
+    local parts = {}
+    table.insert(parts, C.comment(func.name .. " (batch)"))
+    table.insert(parts, self:batch_entry_point_declaration(f_id))
+    table.insert(parts, "{")
+
+    table.insert(parts, util.render([[
+        int nargs = lua_gettop(L);
+        if (nargs != $n) {
+            pallene_runtime_arity_error(L, $fname, $n, $n, nargs);
+        }
+        StackValue *base = L->ci->func.p;
+        CClosure *func = clCvalue(&clCvalue(s2v(base))->upvalue[0]);
+        Udata *K = uvalue(&func->upvalue[0]);
+    ]], {
+        n = C.integer(n_arrays),
+        fname = C.string(func.name),
+    }))
+
+    if self.flags.use_traceback then
+        table.insert(parts, "PALLENE_LUA_FRAMEENTER(" .. self:batch_entry_point_name(f_id) .. ");")
+    end
+
+    -- The arrays are checked only once
+    local arrays = {}
+    for i = 1, n_arrays do
+        local arr = string.format("arr%d", i)
+        local description_fmt, what
+        if i <= #arg_types then
+            description_fmt, what = "argument '%s'", C.string(func.vars[i].name)
+        else
+            description_fmt, what = "output array %d", C.integer(i - #arg_types)
+        end
+        table.insert(arrays, arr)
+        table.insert(parts, C.declaration(ctype(types.T.Array(types.T.Any)), arr) .. ";")
+        table.insert(parts,
+            self:get_stack_slot(
+                types.T.Array(types.T.Any), arr, string.format("s2v(base + %s)", C.integer(i)),
+                func.loc, description_fmt, what))
+    end
+
+    -- The loop
+    local line = C.integer(func.loc and func.loc.line or 0)
+    local body = {}
+    local arg_vars = {}
+    for i, typ in ipairs(arg_types) do
+        local x = self:c_var(i)
+        table.insert(arg_vars, x)
+        table.insert(body, C.declaration(ctype(typ), x) .. ";")
+        table.insert(body, util.render([[
+            pallene_renormalize_array(L, $arr, i, PALLENE_SOURCE_FILE, $line);
+            {
+                TValue *slot = &$arr->array[i - 1];
+                ${get_slot}
+            }
+        ]], {
+            arr = arrays[i],
+            line = line,
+            get_slot = self:get_luatable_slot(typ, x, "slot", arrays[i], func.loc,
+                "element of argument '%s'", C.string(func.vars[i].name)),
+        }))
+    end
+
+    local ret_vars = {}
+    for i, typ in ipairs(ret_types) do
+        local ret = string.format("ret%d", i)
+        table.insert(ret_vars, ret)
+        table.insert(body, C.declaration(ctype(typ), ret) .. ";")
+    end
+    table.insert(body, self:call_pallene_function(ret_vars, f_id, "func", arg_vars))
+
+    for i, typ in ipairs(ret_types) do
+        local arr = arrays[#arg_types + i]
+        table.insert(body, util.render([[
+            pallene_renormalize_array(L, $arr, i, PALLENE_SOURCE_FILE, $line);
+            {
+                TValue *slot = &$arr->array[i - 1];
+                ${set_heap_slot}
+            }
+        ]], {
+            arr = arr,
+            line = line,
+            set_heap_slot = set_heap_slot(typ, "slot", ret_vars[i], arr),
+        }))
+    end
+
+    table.insert(parts, "lua_Integer n = luaH_getn(arr1);")
+    table.insert(parts, self:entry_stack_check(f_id))
+    table.insert(parts, util.render([[
+        for (lua_Integer i = 1; i <= n; i++) {
+            ${body}
+        }
+    ]], {
+        body = concat_lines(body),
+    }))
+
+    if self.flags.use_traceback then
+        table.insert(parts, "PALLENE_LUA_FRAMEEXIT();")
+    end
+    table.insert(parts, "return 0;")
+    table.insert(parts, "}")
+    return concat_lines(parts)
+end
+
 --
 -- # Global coder
 --
@@ -734,6 +1049,7 @@ end
 define_union("Constant", {
     Metatable = {"typ"},
     String = {"str"},
+    Closure = {"f_id"},
     DebugUserdata = {},
     DebugMetatable = {},
 })
@@ -768,6 +1084,25 @@ function Coder:init_upvalues()
             end
         end
     end
+
+    -- Closures without upvalues, other than K. They are the same every time, so we create them once
+    -- when the module is loaded, instead of allocating a new one every time that NewClosure runs.
+    -- This also covers closures whose captured variables were all removed by constant_propagation.
+    for _, func in ipairs(self.module.functions) do
+        for _, block in ipairs(func.blocks) do
+            for _, cmd in ipairs(block.cmds) do
+                if cmd._tag == "ir.Cmd.NewClosure" then
+                    local f_id = cmd.f_id
+                    if #self.module.functions[f_id].captured_vars == 0 and
+                        not self.k_slot_of_closure[f_id]
+                    then
+                        table.insert(self.constants, coder.Constant.Closure(f_id))
+                        self.k_slot_of_closure[f_id] = #self.constants
+                    end
+                end
+            end
+        end
+    end
 end
 
 local function upvalue_slot(ix)
@@ -784,6 +1119,11 @@ function Coder:string_upvalue_slot(str)
     return upvalue_slot(ix)
 end
 
+function Coder:closure_upvalue_slot(f_id)
+    local ix = assert(self.k_slot_of_closure[f_id])
+    return upvalue_slot(ix)
+end
+
 --
 -- # Records
 --
@@ -956,11 +1296,6 @@ end
 --
 
 function Coder:init_gc()
-
-    for _, func in ipairs(self.module.functions) do
-        self.gc[func] = gc.compute_gc_info(func)
-    end
-
     for _, func in ipairs(self.module.functions) do
         local max = 0
         for _,block in ipairs(func.blocks) do
@@ -980,6 +1315,78 @@ function Coder:init_gc()
     end
 end
 
+-- The GC info is computed on demand, and we only keep the one for the function that is currently
+-- being generated. This way, we don't need to hold the liveness data for the whole module at once.
+function Coder:get_gc_info(func)
+    if self.gc_func ~= func then
+        self.gc_func = func
+        self.gc_info = self.gc_info_of[func] or gc.compute_gc_info(func)
+        self.gc_info_of[func] = nil
+        self.max_frame_size_of[func] = self.gc_info.max_frame_size
+    end
+    return self.gc_info
+end
+
+-- The stack checks need the frame size of the callees, which we might not have generated yet. In
+-- that case we keep their GC info until we generate them, so that we only compute it once.
+function Coder:max_frame_size(func)
+    local n = self.max_frame_size_of[func]
+    if not n then
+        local gc_info = gc.compute_gc_info(func)
+        self.gc_info_of[func] = gc_info
+        self.max_frame_size_of[func] = gc_info.max_frame_size
+        n = gc_info.max_frame_size
+    end
+    return n
+end
+
+-- How many free stack slots there must be when we enter the function f_id: enough for its own
+-- frame and Lua calls, and for the functions that it calls statically. The recursive callees are
+-- left out, because they check for themselves. See stack_checks.lua.
+function Coder:stack_slots_needed(f_id)
+    local n = self.slots_needed_of[f_id]
+    if not n then
+        local func = self.module.functions[f_id]
+        local frame_size = self:max_frame_size(func)
+        n = frame_size + self.max_lua_call_stack_usage[func]
+        for _, g_id in ipairs(self.static_callees[f_id]) do
+            if not self.is_recursive[g_id] then
+                n = math.max(n, frame_size + self:stack_slots_needed(g_id))
+            end
+        end
+        self.slots_needed_of[f_id] = n
+    end
+    return n
+end
+
+-- Most of the time the current CallInfo already has enough space, so we only call lua_checkstack
+-- when it doesn't. This is equivalent to calling lua_checkstack, which also raises ci->top.
+function Coder:stack_check(slots_needed, setline)
+    if slots_needed == 0 then
+        return ""
+    end
+    return util.render([[
+        if (l_unlikely(L->ci->top.p - L->top.p < $n)) {
+            ${setline}
+            pallene_grow_stack(L, $n);
+        }
+    ]], {
+        n = C.integer(slots_needed),
+        setline = setline,
+    })
+end
+
+-- Recursive functions check for stack space in the Pallene entry point, and the others do it in
+-- the entry points that Lua calls, once for every function that they call. The entry points don't
+-- set the line before growing the stack: the top frame is still their Lua frame, and the lite
+-- tracer keeps its stack position there. If the stack can't grow, Lua reports that by itself.
+function Coder:entry_stack_check(f_id)
+    if self.is_recursive[f_id] then
+        return ""
+    end
+    return self:stack_check(self:stack_slots_needed(f_id), "")
+end
+
 --
 -- # Call stack managements
 --
@@ -999,7 +1406,7 @@ end
 -- to do it before function calls because the stack-gowing logic relies on having the right "top".
 
 function Coder:update_stack_top(cmd_position)
-    local gc_info = self.gc[self.current_func]
+    local gc_info = self:get_gc_info(self.current_func)
     local live_vars = gc_info.live_gc_vars[cmd_position.block_index][cmd_position.cmd_index]
     local offset = 0
     for _, v_id in ipairs(live_vars) do
@@ -1009,6 +1416,19 @@ function Coder:update_stack_top(cmd_position)
     return util.render("L->top.p = base + $offset;", { offset = C.integer(offset) })
 end
 
+-- Function calls are potential garbage collection sites, so the live GC variables must be in the
+-- Lua stack when we call them. The callee is false for dynamic calls.
+function Coder:remark_safepoint(args, callee)
+    if not self.remarks then return end
+    local gc_info = self:get_gc_info(self.current_func)
+    local pos = args.position
+    local live = {}
+    for _, v_id in ipairs(gc_info.live_gc_vars[pos.block_index][pos.cmd_index]) do
+        table.insert(live, self:var_name(v_id))
+    end
+    self:remark(args.cmd.loc, "safepoint", { call = callee, live = live })
+end
+
 function Coder:savestack()
     return [[ptrdiff_t base_offset = savestack(L, base);]]
 end
@@ -1099,6 +1519,7 @@ gen_cmd["Binop"] = function(self, args)
     -- For integer division and modulus:
     local function int_division(fname)
         local line = args.cmd.loc.line
+        self:remark(args.cmd.loc, "division_by_zero_check", { op = args.cmd.op })
         return (util.render([[ $dst = $fname(L, $x, $y, PALLENE_SOURCE_FILE, $line); ]], {
             fname = fname,
             dst = dst,
@@ -1270,9 +1691,13 @@ gen_cmd["RenormArr"] = function(self, args)
     local i   = self:c_value(args.cmd.src_i)
     local line = C.integer(args.cmd.loc.line)
 
+    self:remark(args.cmd.loc, "renormalize_array", {})
+
     return (util.render([[
+        ${count_check}
         pallene_renormalize_array(L, $arr, $i, PALLENE_SOURCE_FILE, $line);
     ]], {
+        count_check = self:count_check(args.cmd.loc, "renormalize_array", "array"),
         arr = arr,
         i = i,
         line = line,
@@ -1341,10 +1766,13 @@ gen_cmd["GetTable"] = function(self, args)
     return util.render([[
         {
             static int cache = -1;
+            ${count_check}
             TValue *slot = pallene_getstr($field_len, $tab, $key, &cache);
             ${get_slot}
         }
     ]], {
+        count_check = self:count_check(args.cmd.loc, "inline_cache",
+            string.format("field '%s'", field_name)),
         field_len = tostring(#field_name),
         tab = tab,
         key = key,
@@ -1368,9 +1796,12 @@ gen_cmd["SetTable"] = function(self, args)
             TValue keyv; ${init_keyv}
             TValue valv; ${init_valv}
             static int cache = -1;
+            ${count_check}
             TValue *slot = pallene_getstr($field_len, $tab, $key, &cache);
             luaH_finishset(L, $tab, &keyv, slot, &valv);
     ]], {
+        count_check = self:count_check(args.cmd.loc, "inline_cache",
+            string.format("field '%s'", field_name)),
         field_len = tostring(#field_name),
         tab = tab,
         key = key,
@@ -1439,6 +1870,14 @@ end
 gen_cmd["NewClosure"] = function (self, args)
     local func = self.module.functions[args.cmd.f_id]
 
+    if self.k_slot_of_closure[args.cmd.f_id] then
+        local typ = args.func.vars[args.cmd.dst].typ
+        return (util.render([[ $dst = $closure; ]], {
+            dst = self:c_var(args.cmd.dst),
+            closure = lua_value(typ, self:closure_upvalue_slot(args.cmd.f_id)),
+        }))
+    end
+
     -- The number of upvalues must fit inside a byte (the nupvalues in the ClosureHeader).
     -- However, we must check this limit ourselves, because luaF_newCclosure doesn't. If we have too
     -- many upvalues then that internal Lua function can overflow and do weird things.
@@ -1462,6 +1901,12 @@ end
 gen_cmd["InitUpvalues"] = function(self, args)
     local func = self.module.functions[args.cmd.f_id]
 
+    -- Constant propagation may have removed all the captured variables. In that case the closure
+    -- came from K and we must not touch it.
+    if #args.cmd.srcs == 0 then
+        return ""
+    end
+
     assert(args.cmd.src_f._tag == "ir.Value.LocalVar")
     local cclosure = string.format("clCvalue(&%s)", self:c_var(args.cmd.src_f.id))
 
@@ -1512,9 +1957,9 @@ gen_cmd["CallStatic"] = function(self, args)
         tagged_union.error(f_val._tag)
     end
 
+    self:remark_safepoint(args, self.module.functions[f_id].name)
     table.insert(parts, self:update_stack_top(args.position))
-    table.insert(parts, string.format("PALLENE_SETLINE(%s);",
-        C.integer(args.func.loc and args.func.loc.line or 0)))
+    table.insert(parts, string.format("PALLENE_SETLINE(%s);", C.integer(args.cmd.loc.line)))
 
     table.insert(parts, self:call_pallene_function(dsts, f_id, cclosure, xs, nil))
     table.insert(parts, self:restorestack())
@@ -1523,6 +1968,7 @@ end
 
 gen_cmd["CallDyn"] = function(self, args)
     local f_typ = args.cmd.f_typ
+    self:remark_safepoint(args, false)
     local dsts = {}
     for i, dst in ipairs(args.cmd.dsts) do
         dsts[i] = dst and self:c_var(dst)
@@ -1552,7 +1998,7 @@ gen_cmd["CallDyn"] = function(self, args)
     end
 
     local setline = util.render([[ PALLENE_SETLINE($line); ]], {
-        line = C.integer(args.func.loc and args.func.loc.line or 0)
+        line = C.integer(args.cmd.loc.line)
     })
 
     return util.render([[
@@ -1773,8 +2219,27 @@ gen_cmd["Jmp"] = function(self, args)
 end
 
 gen_cmd["JmpIf"] = function(self, args)
-    return util.render("if($v) {goto $t;} else {goto $f;}", {
-        v = self:c_value(args.cmd.src_cond),
+    local cond = self:c_value(args.cmd.src_cond)
+    local count_true = ""
+
+    -- Profile feedback. Only trust branches that were taken at least a handful of times.
+    local func = args.func
+    local block_i = args.position.block_index
+    if func.block_counts and func.block_counts[block_i] >= 10 then
+        local ratio = func.true_counts[block_i] / func.block_counts[block_i]
+        if     ratio >= 0.9 then cond = "l_likely(" .. cond .. ")"
+        elseif ratio <= 0.1 then cond = "l_unlikely(" .. cond .. ")"
+        end
+    end
+
+    if self.pgo_offsets then
+        local k = pgo.block_counter(self.pgo_offsets, self.current_f_id, block_i)
+        count_true = string.format("pallene_pgo_counters[%d]++; ", k + 1)
+    end
+
+    return util.render("if($v) {${count_true}goto $t;} else {goto $f;}", {
+        v = cond,
+        count_true = count_true,
         t = self:c_label(args.cmd.target_true),
         f = self:c_label(args.cmd.target_false),
     })
@@ -1785,16 +2250,100 @@ gen_cmd["Nop"] = function()
 end
 
 gen_cmd["CheckGC"] = function(self, args)
+    local pos = args.position
+    local site = self.gc_site_of[args.func]
+    site = site and site[pos.block_index] and site[pos.block_index][pos.cmd_index]
+    if site then
+        return util.render([[
+            {
+                unsigned long long gc_start;
+                luaC_condGC(L, ${update_stack_top} gc_start = pallene_stats_now(),
+                            PALLENE_ALLOC_GC($site, gc_start));
+            }
+        ]], {
+            update_stack_top = self:update_stack_top(pos),
+            site = C.integer(site - 1),
+        })
+    end
     return util.render([[ luaC_condGC(L, ${update_stack_top}, (void)0); ]], {
-        update_stack_top = self:update_stack_top(args.position) })
+        update_stack_top = self:update_stack_top(pos) })
+end
+
+-- The commands that allocate a garbage-collected object, for --instrument-allocs. They are always
+-- followed by a CheckGC.
+local alloc_kind = {
+    NewArr = "array",
+    NewTable = "table",
+    NewRecord = "record",
+    NewClosure = "closure",
+    Concat = "string",
+    BuiltinStringChar = "string",
+    BuiltinStringSub = "string",
+}
+
+-- How many bytes each of them allocates, as a C expression. We run it after the command, so it can
+-- look at the new object.
+local function string_size(self, cmd)
+    local dst = cmd.dst and self:c_var(cmd.dst) or self:c_var(cmd.dsts[1])
+    return util.render([[sizelstring(tsslen($dst))]], { dst = dst })
+end
+
+local alloc_size = {
+    NewArr = function(self, cmd)
+        return util.render([[sizeof(Table) + (size_t) $n * sizeof(TValue)]], {
+            n = self:c_value(cmd.src_size) })
+    end,
+    NewTable = function(self, cmd)
+        return util.render([[sizeof(Table) + (size_t) $n * sizeof(Node)]], {
+            n = self:c_value(cmd.src_size) })
+    end,
+    NewRecord = function(self, cmd)
+        return util.render([[sizeudata($rec->nuvalue, $rec->len)]], {
+            rec = self:c_var(cmd.dst) })
+    end,
+    NewClosure = function(self, cmd)
+        local func = self.module.functions[cmd.f_id]
+        return util.render([[sizeCclosure($n)]], {
+            n = C.integer(#func.captured_vars + 1) })
+    end,
+    Concat = string_size,
+    BuiltinStringChar = string_size,
+    BuiltinStringSub = string_size,
+}
+
+-- The order in which we emit the basic blocks. Normally it is the same order as in the IR, but if
+-- we have profile feedback we move the blocks that never ran to the end of the function, so they
+-- don't get in the way of the hot code. The first block is the function entry so it stays put. The
+-- last block is the exit block, which has no jump and falls through into the return code that comes
+-- after the blocks, so it must stay last too.
+local function block_layout(func)
+    local n = #func.blocks
+    local order = {}
+    local cold = {}
+    for block_i = 1, n - 1 do
+        if func.block_counts and func.block_counts[1] > 0 and func.block_counts[block_i] == 0 then
+            table.insert(cold, block_i)
+        else
+            table.insert(order, block_i)
+        end
+    end
+    table.move(cold, 1, #cold, #order + 1, order)
+    table.insert(order, n)
+    return order
 end
 
 function Coder:generate_blocks(func)
     local out = {}
-    for block_i, block in ipairs(func.blocks) do
+    local order = block_layout(func)
+    for pos, block_i in ipairs(order) do
+        local block = func.blocks[block_i]
         table.insert(out, self:c_label(block_i) .. ":")
+        if self.pgo_offsets then
+            local k = pgo.block_counter(self.pgo_offsets, self.current_f_id, block_i)
+            table.insert(out, string.format("pallene_pgo_counters[%d]++;", k))
+        end
         for cmd_i,cmd in ipairs(block.cmds) do
-            if cmd._tag ~= "ir.Cmd.Jmp" or cmd.target ~= block_i + 1 then
+            if cmd._tag ~= "ir.Cmd.Jmp" or cmd.target ~= order[pos + 1] then
                 table.insert(out, self:generate_cmd({
                     cmd = cmd,
                     func = func,
@@ -1819,13 +2368,22 @@ function Coder:generate_cmd(gen_args)
     local out = {}
     table.insert(out, f(self, gen_args))
 
-    local slot_of_variable = self.gc[func].slot_of_variable
+    local site = self.alloc_site_of[cmd]
+    if site then
+        table.insert(out, util.render([[ PALLENE_ALLOC_COUNT($site, $bytes); ]], {
+            site = C.integer(site - 1),
+            bytes = alloc_size[name](self, cmd),
+        }))
+    end
+
+    local slot_of_variable = self:get_gc_info(func).slot_of_variable
     for _, v_id in ipairs(ir.get_dsts(cmd)) do
         local n = slot_of_variable[v_id]
         if n then
             local typ = func.vars[v_id].typ
             local slot = util.render([[s2v(base + $n)]], { n = C.integer(n) })
             table.insert(out, set_stack_slot(typ, slot, self:c_var(v_id)))
+            self:remark(cmd.loc, "stack_mirror", { variable = self:var_name(v_id), slot = n })
         end
     end
 
@@ -1852,10 +2410,33 @@ function Coder:generate_module_header()
 
     table.insert(out, "/* This file was generated by the Pallene compiler. Do not edit by hand */")
     table.insert(out, "")
+    if self.linkage ~= "static" then
+        -- This is the internal header of a module that was split. See Coder:generate_units.
+        table.insert(out, "#ifndef PALLENE_MAIN_UNIT")
+        table.insert(out, "#define PT_IMPLEMENTED /* The Pallene Tracer goes in the main unit. */")
+        table.insert(out, "#endif")
+        table.insert(out, "#define PALLENE_INTERNAL __attribute__((visibility(\"hidden\")))")
+        table.insert(out, "")
+    end
     table.insert(out, string.format("#define PALLENE_SOURCE_FILE %s", C.string(self.filename)))
     if self.flags.use_traceback then
         table.insert(out, "/* Enable Pallene Tracer debugging. */")
         table.insert(out, "#define PT_DEBUG")
+        if self.flags.traceback_lite then
+            table.insert(out, "#define PT_LITE")
+        end
+    end
+    if self.flags.instrument then
+        table.insert(out, "/* Count the calls and measure the time of each function. */")
+        table.insert(out, "#define PALLENE_INSTRUMENT")
+    end
+    if self.flags.instrument_allocs then
+        table.insert(out, "/* Count the allocations of each line. */")
+        table.insert(out, "#define PALLENE_INSTRUMENT_ALLOCS")
+    end
+    if self.flags.instrument_checks then
+        table.insert(out, "/* Count how many times each runtime check runs. */")
+        table.insert(out, "#define PALLENE_INSTRUMENT_CHECKS")
     end
     table.insert(out, section_comment("Pallene standard library"))
     table.insert(out, pallenelib)
@@ -1863,40 +2444,808 @@ function Coder:generate_module_header()
     return concat_lines(out)
 end
 
-function Coder:generate_module_body()
-
-    local out = {}
+-- Writes pieces of C code through a C.Formatter, with a blank line between consecutive pieces.
+-- Returns the function that emits a piece, and the function to call at the end.
+local function Emitter(output)
+    local formatter = C.Formatter.new(output)
+    local is_first = true
+    local function emit(code)
+        if not is_first then
+            formatter:write("")
+        end
+        is_first = false
+        formatter:write((code:gsub("%s*$", "")))
+    end
+    local function finish()
+        formatter:finish()
+    end
+    return emit, finish
+end
 
-    table.insert(out, section_comment("Records"))
+function Coder:generate_declarations(emit)
+    emit(section_comment("Records"))
     for _, typ in ipairs(self.module.record_types) do
         local rc = self.record_coders[typ]
-        table.insert(out, rc:declarations())
+        emit(rc:declarations())
     end
 
-    table.insert(out, section_comment("Function Prototypes"))
+    emit(section_comment("Function Prototypes"))
     for f_id = 1, #self.module.functions do
-        table.insert(out, self:pallene_entry_point_declaration(f_id) .. ";")
+        emit(self:pallene_entry_point_declaration(f_id) .. ";")
     end
 
     local lua_entry_protos = {}
     for f_id = 1, #self.module.functions do
         table.insert(lua_entry_protos, self:lua_entry_point_declaration(f_id) .. ";")
     end
-    table.insert(out, concat_lines(lua_entry_protos))
+    emit(concat_lines(lua_entry_protos))
 
-    table.insert(out, section_comment("Pallene Entry Points"))
+    local batch_entry_protos = {}
     for f_id = 1, #self.module.functions do
-        table.insert(out, self:pallene_entry_point_definition(f_id))
+        if self.has_batch_entry_point[f_id] then
+            table.insert(batch_entry_protos, self:batch_entry_point_declaration(f_id) .. ";")
+        end
+    end
+    if #batch_entry_protos > 0 then
+        emit(concat_lines(batch_entry_protos))
     end
 
-    table.insert(out, section_comment("Lua Entry Points"))
+    emit(util.render([[
+        $linkage PALLENE_COLD l_noret pallene_tag_check_failed(
+            lua_State *L, int site, const TValue *slot);
+    ]], { linkage = self.linkage }))
+
+    if self.flags.instrument then
+        emit(section_comment("Instrumentation"))
+        -- When the module is split, they are defined by generate_stats_function.
+        local storage = (self.linkage == "static") and "static" or "extern PALLENE_INTERNAL"
+        emit(util.render([[
+            $storage pallene_stats_t pallene_stats[$n];
+            $storage unsigned long long pallene_stats_children;
+        ]], {
+            storage = storage,
+            n = C.integer(#self.module.functions),
+        }))
+    end
+
+    if self.flags.instrument_allocs then
+        emit(section_comment("Allocation sites"))
+        -- When the module is split, it is defined by generate_allocs_function.
+        local storage = (self.linkage == "static") and "static" or "extern PALLENE_INTERNAL"
+        emit(util.render([[
+            $storage pallene_alloc_site_t pallene_alloc_sites[$n];
+        ]], {
+            storage = storage,
+            n = C.integer(#self.alloc_sites),
+        }))
+    end
+end
+
+function Coder:generate_definitions(emit, f_ids)
+    emit(section_comment("Pallene Entry Points"))
+    for _, f_id in ipairs(f_ids) do
+        emit(self:pallene_entry_point_definition(f_id))
+    end
+
+    emit(section_comment("Lua Entry Points"))
+    for _, f_id in ipairs(f_ids) do
+        emit(self:lua_entry_point_definition(f_id))
+    end
+
+    if self.flags.batch_entry_points then
+        emit(section_comment("Batch Entry Points"))
+        for _, f_id in ipairs(f_ids) do
+            if self.has_batch_entry_point[f_id] then
+                emit(self:batch_entry_point_definition(f_id))
+            end
+        end
+    end
+end
+
+-- The C code is written piece by piece, as soon as each piece is ready. The module header, which
+-- contains the Pallene standard library, is written as-is. Everything else goes through the
+-- formatter.
+function Coder:generate_module(output)
+    output:write(self:generate_module_header(), "\n")
+
+    local emit, finish = Emitter(output)
+
+    self:generate_declarations(emit)
+
+    if self.pgo_offsets then
+        emit(section_comment("Profile Counters"))
+        emit(self:generate_pgo_counters())
+    end
+
+    local f_ids = {}
     for f_id = 1, #self.module.functions do
-        table.insert(out, self:lua_entry_point_definition(f_id))
+        f_ids[f_id] = f_id
+    end
+    self:generate_definitions(emit, f_ids)
+
+    -- The C API wrappers have tag checks, so they must come before the tables of check sites.
+    if self.flags.emit_c_api then
+        emit(self:generate_c_api())
+    end
+
+    emit(self:generate_tag_check_sites())
+
+    if self.flags.instrument then
+        emit(self:generate_stats_function())
+    end
+    if self.flags.instrument_allocs then
+        emit(self:generate_allocs_function())
     end
+    if self.flags.instrument_checks then
+        emit(self:generate_checks_function())
+    end
+    emit(self:generate_luaopen_function())
+
+    finish()
+end
+
+-- When we split the module into several translation units, the header has everything that they
+-- need to share: the Pallene standard library, the records, and the function prototypes. The
+-- indices of the constants in K are integer literals, which are the same in every unit because all
+-- of them are generated by the same Coder. The functions are not static anymore, but they still
+-- have hidden visibility. They can be seen by the other units, but are not exported by the .so.
+--
+-- The Pallene Tracer implementation is only included in the first unit, which also has the luaopen
+-- function. The PGO counters are not supported in this mode.
+function Coder:generate_units(header_output, unit_outputs, header_name, units)
+    assert(not self.pgo_offsets, "PGO is not supported when splitting into several units")
+    self.linkage = "PALLENE_INTERNAL"
+
+    header_output:write(self:generate_module_header(), "\n")
+    do
+        local emit, finish = Emitter(header_output)
+        self:generate_declarations(emit)
+        finish()
+    end
+
+    -- The main unit goes last, so the --instrument-checks counters are known when we define them.
+    local order = {}
+    for i = 2, #units do
+        table.insert(order, i)
+    end
+    table.insert(order, 1)
+
+    for _, i in ipairs(order) do
+        local f_ids = units[i]
+        local output = unit_outputs[i]
+        output:write("/* This file was generated by the Pallene compiler. Do not edit by hand */\n")
+        if i == 1 then
+            output:write("#define PALLENE_MAIN_UNIT\n")
+        end
+        output:write(string.format("#include %s\n", C.string(header_name)))
+
+        local emit, finish = Emitter(output)
+        self:generate_definitions(emit, f_ids)
+        if i == 1 then
+            if self.flags.emit_c_api then
+                emit(self:generate_c_api())
+            end
+            emit(self:generate_tag_check_sites())
+            if self.flags.instrument then
+                emit(self:generate_stats_function())
+            end
+            if self.flags.instrument_allocs then
+                emit(self:generate_allocs_function())
+            end
+            if self.flags.instrument_checks then
+                emit(self:generate_checks_function())
+            end
+            emit(self:generate_luaopen_function())
+        end
+        finish()
+    end
+end
+
+--
+-- # C API
+--
+-- With --emit-c-api, a C program that embeds Lua can call the exported functions directly, instead
+-- of pushing the arguments and calling lua_call. The coder adds a wrapper around the Pallene entry
+-- point of each exported function that the C API supports, and the driver writes a header that
+-- declares them (foo_api.h, for foo.pln). See "Calling Pallene from C" in the README.
+--
+-- Integers, floats and booleans are passed by value. Strings, arrays, tables and records are passed
+-- by their index in the Lua stack, because the host must keep them there while the function runs,
+-- so that the garbage collector can see them. For the same reason, the functions can only return
+-- integers, floats and booleans. The other functions are left out.
+--
+-- The wrappers get the closures of the exported functions, and through them the constant table K,
+-- from the pallene_foo_api object that pallene_foo_open_api creates and anchors in the registry.
+
+local function c_api_arg_type(typ)
+    local tag = typ._tag
+    if     tag == "types.T.Boolean" then return "int"
+    elseif tag == "types.T.Integer" then return "lua_Integer"
+    elseif tag == "types.T.Float"   then return "lua_Number"
+    elseif tag == "types.T.String"  then return "int"
+    elseif tag == "types.T.Array"   then return "int"
+    elseif tag == "types.T.Table"   then return "int"
+    elseif tag == "types.T.Record"  then return "int"
+    else return false
+    end
+end
+
+local function c_api_ret_type(typ)
+    local tag = typ._tag
+    if     tag == "types.T.Boolean" then return "int"
+    elseif tag == "types.T.Integer" then return "lua_Integer"
+    elseif tag == "types.T.Float"   then return "lua_Number"
+    else return false
+    end
+end
+
+-- Is the value passed by its index in the Lua stack?
+local function c_api_by_index(typ)
+    return c_api_arg_type(typ) == "int" and typ._tag ~= "types.T.Boolean"
+end
+
+local function c_api_supports(func)
+    for _, typ in ipairs(func.typ.arg_types) do
+        if not c_api_arg_type(typ) then return false end
+    end
+    for _, typ in ipairs(func.typ.ret_types) do
+        if not c_api_ret_type(typ) then return false end
+    end
+    return true
+end
+
+-- @returns the f_ids of the exported functions that are in the C API, and the ones that are not.
+local function c_api_functions(module)
+    local supported, unsupported = {}, {}
+    for _, f_id in ipairs(module.exported_functions) do
+        local func = module.functions[f_id]
+        table.insert(c_api_supports(func) and supported or unsupported, f_id)
+    end
+    return supported, unsupported
+end
+
+-- The signature of the function in Pallene, for the comments in the header.
+local function c_api_pallene_signature(func)
+    local args = {}
+    for i, typ in ipairs(func.typ.arg_types) do
+        table.insert(args, func.vars[i].name .. ": " .. types.tostring(typ))
+    end
+    local rets = {}
+    for _, typ in ipairs(func.typ.ret_types) do
+        table.insert(rets, types.tostring(typ))
+    end
+    local sig = func.name .. "(" .. table.concat(args, ", ") .. ")"
+    if #rets == 1 then
+        sig = sig .. ": " .. rets[1]
+    elseif #rets > 1 then
+        sig = sig .. ": (" .. table.concat(rets, ", ") .. ")"
+    end
+    return sig
+end
+
+-- Like the Pallene entry point, the first return value is the return value of the C function and
+-- the others are written through pointers.
+local function c_api_prototype(modname, func)
+    local params = { "lua_State *L", string.format("pallene_%s_api *api", modname) }
+    for i, typ in ipairs(func.typ.arg_types) do
+        local name = c_api_by_index(typ) and string.format("idx%d", i) or string.format("x%d", i)
+        table.insert(params, C.declaration(c_api_arg_type(typ), name))
+    end
+    for i = 2, #func.typ.ret_types do
+        local typ = func.typ.ret_types[i]
+        table.insert(params, C.declaration(c_api_ret_type(typ) .. " *", string.format("ret%d", i)))
+    end
+    local ret_ctype = (#func.typ.ret_types > 0) and c_api_ret_type(func.typ.ret_types[1]) or "void"
+    return (util.render([[$ret $name($params)]], {
+        ret = ret_ctype,
+        name = string.format("pallene_%s_%s", modname, func.name),
+        params = table.concat(params, ", "),
+    }))
+end
+
+-- The header is not formatted by C.Formatter, because it would indent the extern "C" block.
+function coder.generate_c_api_header(module, modname)
+    local supported, unsupported = c_api_functions(module)
+    local api = string.format("pallene_%s_api", modname)
+    local guard = string.format("PALLENE_%s_API_H", string.upper(modname))
+
+    local out = {}
+    table.insert(out, "/* This file was generated by the Pallene compiler. Do not edit by hand */")
+    table.insert(out, "")
+    table.insert(out, string.format(
+        "/* The C API of the Pallene module %s. See \"Calling Pallene from C\" in the README. */",
+        modname))
+    table.insert(out, "")
+    table.insert(out, "#ifndef " .. guard)
+    table.insert(out, "#define " .. guard)
+    table.insert(out, "")
+    table.insert(out, "#include <lua.h>")
+    table.insert(out, "")
+    table.insert(out, "#ifdef __cplusplus")
+    table.insert(out, "extern \"C\" {")
+    table.insert(out, "#endif")
+    table.insert(out, "")
+    table.insert(out, string.format("typedef struct %s %s;", api, api))
+    table.insert(out, "")
+    table.insert(out, "/* The loader of the module, for luaL_requiref. */")
+    table.insert(out, string.format("int luaopen_%s(lua_State *L);", modname))
+    table.insert(out, "")
+    table.insert(out, string.format(
+        "/* Call this after luaopen_%s, with the module table at [module] in the Lua stack. It",
+        modname))
+    table.insert(out,
+        " * returns the same object every time, which stays valid while the lua_State is open. */")
+    table.insert(out, string.format(
+        "%s *pallene_%s_open_api(lua_State *L, int module);", api, modname))
+    for _, f_id in ipairs(supported) do
+        local func = module.functions[f_id]
+        table.insert(out, "")
+        table.insert(out, C.comment(c_api_pallene_signature(func)))
+        table.insert(out, c_api_prototype(modname, func) .. ";")
+    end
+    if #unsupported > 0 then
+        table.insert(out, "")
+    end
+    for _, f_id in ipairs(unsupported) do
+        local func = module.functions[f_id]
+        table.insert(out, C.comment("Not in the C API: " .. c_api_pallene_signature(func)))
+    end
+    table.insert(out, "")
+    table.insert(out, "#ifdef __cplusplus")
+    table.insert(out, "}")
+    table.insert(out, "#endif")
+    table.insert(out, "")
+    table.insert(out, "#endif")
+    table.insert(out, "")
+    return table.concat(out, "\n")
+end
+
+-- The wrappers, together with the pallene_foo_api object and the function that creates it.
+function Coder:generate_c_api()
+    assert(not self.flags.use_traceback, "the C API doesn't support tracebacks")
+    local modname = self.modname
+    local supported = c_api_functions(self.module)
+
+    local parts = {}
+    table.insert(parts, section_comment("C API"))
+
+    table.insert(parts, util.render([[
+        struct pallene_${modname}_api {
+            CClosure *functions[$n];
+        };
+
+        /* The value at [idx] in the Lua stack. Negative indices count from the top. */
+        static TValue *pallene_c_api_value(lua_State *L, int idx)
+        {
+            return s2v((idx > 0) ? L->ci->func.p + idx : L->top.p + idx);
+        }
+    ]], {
+        modname = modname,
+        n = C.integer(math.max(1, #supported)),
+    }))
+
+    local get_functions = {}
+    for i, f_id in ipairs(supported) do
+        table.insert(get_functions, util.render([[
+            lua_getfield(L, module, $name);
+            if (lua_tocfunction(L, -1) != $lua_entry_point) {
+                luaL_error(L, "the module table doesn't have the original '%s'", $name);
+            }
+            api->functions[$i] = clCvalue(s2v(L->top.p - 1));
+            lua_setiuservalue(L, -2, $uv);
+        ]], {
+            name = C.string(self.module.functions[f_id].name),
+            lua_entry_point = self:lua_entry_point_name(f_id),
+            i = C.integer(i - 1),
+            uv = C.integer(i),
+        }))
+    end
+
+    -- The closures are user values of the api object, so they live as long as it does.
+    table.insert(parts, util.render([[
+        pallene_${modname}_api *pallene_${modname}_open_api(lua_State *L, int module)
+        {
+            module = lua_absindex(L, module);
+            if (lua_getfield(L, LUA_REGISTRYINDEX, $key) == LUA_TUSERDATA) {
+                pallene_${modname}_api *api = lua_touserdata(L, -1);
+                lua_pop(L, 1);
+                return api;
+            }
+            lua_pop(L, 1);
+            pallene_${modname}_api *api = lua_newuserdatauv(L, sizeof(pallene_${modname}_api), $n);
+            ${get_functions}
+            lua_setfield(L, LUA_REGISTRYINDEX, $key);
+            return api;
+        }
+    ]], {
+        modname = modname,
+        key = C.string("pallene_" .. modname .. "_api"),
+        n = C.integer(#supported),
+        get_functions = concat_lines(get_functions),
+    }))
+
+    for i, f_id in ipairs(supported) do
+        table.insert(parts, self:c_api_wrapper_definition(i, f_id))
+    end
+
+    return concat_lines(parts, "\n\n")
+end
+
+function Coder:c_api_wrapper_definition(i, f_id)
+    local func = self.module.functions[f_id]
+    local arg_types = func.typ.arg_types
+    local ret_types = func.typ.ret_types
+
+    self.current_func = func
+    self.current_f_id = f_id
+
+    local parts = {}
+    table.insert(parts, C.comment(c_api_pallene_signature(func)))
+    table.insert(parts, c_api_prototype(self.modname, func))
+    table.insert(parts, "{")
+    table.insert(parts, util.render([[
+        CClosure *func = api->functions[$i];
+        Udata *K = uvalue(&func->upvalue[0]);
+    ]], {
+        i = C.integer(i - 1),
+    }))
+
+    local arg_vars = {}
+    for j, typ in ipairs(arg_types) do
+        local x = self:c_var(j)
+        if typ._tag == "types.T.Boolean" then
+            table.insert(arg_vars, "(" .. x .. " != 0)")
+        elseif c_api_by_index(typ) then
+            local slot = string.format("slot%d", j)
+            table.insert(parts,
+                string.format("TValue *%s = pallene_c_api_value(L, idx%d);", slot, j))
+            table.insert(parts, C.declaration(ctype(typ), x) .. ";")
+            table.insert(parts,
+                self:get_stack_slot(typ, x, slot, func.loc,
+                    "argument '%s'", C.string(func.vars[j].name)))
+            table.insert(arg_vars, x)
+        else
+            table.insert(arg_vars, x)
+        end
+    end
+
+    local stack_check = self:entry_stack_check(f_id)
+    if stack_check ~= "" then
+        table.insert(parts, stack_check)
+    end
+
+    local dsts = {}
+    for j, typ in ipairs(ret_types) do
+        dsts[j] = string.format("r%d", j)
+        table.insert(parts, C.declaration(ctype(typ), dsts[j]) .. ";")
+    end
+    table.insert(parts, self:call_pallene_function(dsts, f_id, "func", arg_vars))
+    for j = 2, #ret_types do
+        table.insert(parts, string.format("*ret%d = r%d;", j, j))
+    end
+    if #ret_types > 0 then
+        table.insert(parts, "return r1;")
+    end
+    table.insert(parts, "}")
+    return concat_lines(parts)
+end
+
+-- The counters for --pgo-generate. They are saved to the profile file when the module is unloaded,
+-- which happens when the Lua state is closed or, at the latest, when the program exits. If the file
+-- already exists and has the same shape, we add to the counts that are already there.
+function Coder:generate_pgo_counters()
+    return (util.render([[
+        #include <stdio.h>
+
+        #define PALLENE_PGO_N_COUNTERS $n
+        static unsigned long long pallene_pgo_counters[PALLENE_PGO_N_COUNTERS + 1];
+
+        __attribute__((destructor))
+        static void pallene_pgo_save_profile(void)
+        {
+            const char *file_name = $file_name;
+            const char *shape = $shape;
+
+            FILE *f = fopen(file_name, "r");
+            if (f) {
+                char old_shape[32];
+                unsigned long n;
+                if (fscanf(f, "pallene-profile %31s %lu", old_shape, &n) == 2 &&
+                    strcmp(old_shape, shape) == 0 && n == PALLENE_PGO_N_COUNTERS) {
+                    for (unsigned long i = 0; i < n; i++) {
+                        unsigned long long count;
+                        if (fscanf(f, "%llu", &count) != 1) break;
+                        pallene_pgo_counters[i] += count;
+                    }
+                }
+                fclose(f);
+            }
+
+            f = fopen(file_name, "w");
+            if (!f) {
+                fprintf(stderr, "pallene: could not write profile %s\n", file_name);
+                return;
+            }
+            fprintf(f, "pallene-profile %s %d\n", shape, PALLENE_PGO_N_COUNTERS);
+            for (unsigned long i = 0; i < PALLENE_PGO_N_COUNTERS; i++) {
+                fprintf(f, "%llu\n", pallene_pgo_counters[i]);
+            }
+            fclose(f);
+        }
+    ]], {
+        n = C.integer(self.pgo_n_counters),
+        file_name = C.string(pgo.profile_file_name(self.flags.pgo_generate, self.modname)),
+        shape = C.string(self.pgo_shape_hash),
+    }))
+end
+
+-- Adds the time of a call to the counters for --instrument. The Pallene entry point fills in the
+-- `calls`, `time` and `self_time` fields, and the Lua entry point the other three.
+function Coder:stats_exit(f_id, calls, time, self_time)
+    return (util.render([[
+        PALLENE_STATS_EXIT(pallene_stats[$i].$calls, pallene_stats[$i].$time,
+                           pallene_stats[$i].$self_time);
+    ]], {
+        i = C.integer(f_id - 1),
+        calls = calls,
+        time = time,
+        self_time = self_time,
+    }))
+end
+
+-- The __pallene_stats function that --instrument adds to the module. It returns a list with the
+-- counters of each function. The times are in seconds.
+function Coder:generate_stats_function()
+    local names = {}
+    local lines = {}
+    for _, func in ipairs(self.module.functions) do
+        table.insert(names, C.string(func.name))
+        table.insert(lines, C.integer(func.loc and func.loc.line or 0))
+    end
+
+    local definitions = ""
+    if self.linkage ~= "static" then
+        definitions = [[
+            PALLENE_INTERNAL pallene_stats_t pallene_stats[PALLENE_STATS_N];
+            PALLENE_INTERNAL unsigned long long pallene_stats_children;
+        ]]
+    end
+
+    return (util.render([[
+        #define PALLENE_STATS_N $n
+        ${definitions}
+        static int pallene_stats_lua(lua_State *L)
+        {
+            static const char *const names[PALLENE_STATS_N] = { $names };
+            static const int lines[PALLENE_STATS_N] = { $lines };
+            lua_createtable(L, PALLENE_STATS_N, 0);
+            for (int i = 0; i < PALLENE_STATS_N; i++) {
+                const pallene_stats_t *s = &pallene_stats[i];
+                lua_createtable(L, 0, 8);
+                lua_pushstring(L, names[i]);
+                lua_setfield(L, -2, "name");
+                lua_pushinteger(L, lines[i]);
+                lua_setfield(L, -2, "line");
+                lua_pushinteger(L, (lua_Integer) s->calls);
+                lua_setfield(L, -2, "calls");
+                lua_pushnumber(L, s->time / 1e9);
+                lua_setfield(L, -2, "time");
+                lua_pushnumber(L, s->self_time / 1e9);
+                lua_setfield(L, -2, "self_time");
+                lua_pushinteger(L, (lua_Integer) s->lua_calls);
+                lua_setfield(L, -2, "lua_calls");
+                lua_pushnumber(L, s->lua_time / 1e9);
+                lua_setfield(L, -2, "lua_time");
+                lua_pushnumber(L, s->boundary_time / 1e9);
+                lua_setfield(L, -2, "boundary_time");
+                lua_seti(L, -2, i + 1);
+            }
+            return 1;
+        }
+    ]], {
+        n = C.integer(#self.module.functions),
+        definitions = definitions,
+        names = table.concat(names, ", "),
+        lines = table.concat(lines, ", "),
+    }))
+end
+
+-- Assigns a counter to each kind of allocation in each line of each function, and remembers which
+-- CheckGC follows which allocation, so we can blame the collector steps on it.
+function Coder:init_alloc_sites()
+    local site_of_key = {} -- "f_id:kind:line" => integer
+    for f_id, func in ipairs(self.module.functions) do
+        local gc_sites = {}
+        for block_i, block in ipairs(func.blocks) do
+            gc_sites[block_i] = {}
+            local last_site = false
+            for cmd_i, cmd in ipairs(block.cmds) do
+                local name = tagged_union.consname(cmd._tag)
+                local kind = alloc_kind[name]
+                if name == "NewClosure" and self.k_slot_of_closure[cmd.f_id] then
+                    kind = false -- It doesn't allocate, see Coder:init_upvalues
+                end
+                if kind then
+                    local line = cmd.loc and cmd.loc.line or 0
+                    local key = string.format("%d:%s:%d", f_id, kind, line)
+                    if not site_of_key[key] then
+                        table.insert(self.alloc_sites, { f_id = f_id, kind = kind, line = line })
+                        site_of_key[key] = #self.alloc_sites
+                    end
+                    last_site = site_of_key[key]
+                    self.alloc_site_of[cmd] = last_site
+                elseif name == "CheckGC" and last_site then
+                    gc_sites[block_i][cmd_i] = last_site
+                    last_site = false
+                end
+            end
+        end
+        self.gc_site_of[func] = gc_sites
+    end
+    assert(#self.alloc_sites > 0) -- The $init function always creates the exports table
+end
 
-    table.insert(out, self:generate_luaopen_function())
+-- The table of tag check sites, which we know after generating all the functions, and the function
+-- that raises their errors. See Coder:get_stack_slot.
+function Coder:generate_tag_check_sites()
+    local sites = {}
+    for _, site in ipairs(self.tag_check_sites) do
+        table.insert(sites, util.render([[{ $file, $line, $expected_type, $description },]], {
+            file = C.string(site.file),
+            line = C.integer(site.line),
+            expected_type = C.string(site.expected_type),
+            description = C.string(site.description),
+        }))
+    end
+    if #sites == 0 then
+        table.insert(sites, "{ NULL, 0, NULL, NULL },") -- C arrays can't be empty
+    end
 
-    return C.reformat(concat_lines(out, "\n\n"))
+    return (util.render([[
+        static const pallene_tag_check_site_t pallene_tag_check_sites[] = {
+            ${sites}
+        };
+
+        $linkage PALLENE_COLD l_noret pallene_tag_check_failed(
+            lua_State *L, int site, const TValue *slot)
+        {
+            const pallene_tag_check_site_t *s = &pallene_tag_check_sites[site];
+            pallene_runtime_tag_check_error(L,
+                s->file, s->line, s->expected_type, slot, "%s", s->description);
+        }
+    ]], {
+        sites = concat_lines(sites),
+        linkage = self.linkage,
+    }))
+end
+
+-- The __pallene_checks function that --instrument-checks adds to the module. It returns a list with
+-- the counter of each runtime check, with the checks that ran the most first.
+function Coder:generate_checks_function()
+    local funcs = {}
+    local kinds = {}
+    local lines = {}
+    local whats = {}
+    for _, site in ipairs(self.check_sites) do
+        table.insert(funcs, C.string(site.func))
+        table.insert(kinds, C.string(site.kind))
+        table.insert(lines, C.integer(site.line))
+        table.insert(whats, C.string(site.what))
+    end
+
+    -- A module might have no runtime checks at all, but C arrays can't be empty.
+    local n = math.max(1, #self.check_sites)
+    local function pad(list)
+        if #list == 0 then list = { "0" } end
+        return table.concat(list, ", ")
+    end
+
+    return (util.render([[
+        #define PALLENE_CHECK_SITES_N $n
+        __attribute__((visibility("hidden")))
+        unsigned long long pallene_check_counts[PALLENE_CHECK_SITES_N];
+
+        static int pallene_checks_cmp(const void *a, const void *b)
+        {
+            unsigned long long x = pallene_check_counts[*(const int *)a];
+            unsigned long long y = pallene_check_counts[*(const int *)b];
+            if (x != y) return (x < y) ? 1 : -1;
+            return *(const int *)a - *(const int *)b;
+        }
+
+        static int pallene_checks_lua(lua_State *L)
+        {
+            static const char *const funcs[PALLENE_CHECK_SITES_N] = { $funcs };
+            static const char *const kinds[PALLENE_CHECK_SITES_N] = { $kinds };
+            static const int lines[PALLENE_CHECK_SITES_N] = { $lines };
+            static const char *const whats[PALLENE_CHECK_SITES_N] = { $whats };
+            int order[PALLENE_CHECK_SITES_N];
+            for (int i = 0; i < $n_sites; i++) order[i] = i;
+            qsort(order, $n_sites, sizeof(int), pallene_checks_cmp);
+            lua_createtable(L, $n_sites, 0);
+            for (int j = 0; j < $n_sites; j++) {
+                int i = order[j];
+                lua_createtable(L, 0, 5);
+                lua_pushstring(L, funcs[i]);
+                lua_setfield(L, -2, "func");
+                lua_pushstring(L, kinds[i]);
+                lua_setfield(L, -2, "kind");
+                lua_pushinteger(L, lines[i]);
+                lua_setfield(L, -2, "line");
+                lua_pushstring(L, whats[i]);
+                lua_setfield(L, -2, "what");
+                lua_pushinteger(L, (lua_Integer) pallene_check_counts[i]);
+                lua_setfield(L, -2, "count");
+                lua_seti(L, -2, j + 1);
+            }
+            return 1;
+        }
+    ]], {
+        n = C.integer(n),
+        n_sites = C.integer(#self.check_sites),
+        funcs = pad(funcs),
+        kinds = pad(kinds),
+        lines = pad(lines),
+        whats = pad(whats),
+    }))
+end
+
+-- The __pallene_allocs function that --instrument-allocs adds to the module. It returns a list with
+-- the counters of each allocation site. The times are in seconds.
+function Coder:generate_allocs_function()
+    local funcs = {}
+    local kinds = {}
+    local lines = {}
+    for _, site in ipairs(self.alloc_sites) do
+        table.insert(funcs, C.string(self.module.functions[site.f_id].name))
+        table.insert(kinds, C.string(site.kind))
+        table.insert(lines, C.integer(site.line))
+    end
+
+    local definitions = ""
+    if self.linkage ~= "static" then
+        definitions = [[
+            PALLENE_INTERNAL pallene_alloc_site_t pallene_alloc_sites[PALLENE_ALLOC_SITES_N];
+        ]]
+    end
+
+    return (util.render([[
+        #define PALLENE_ALLOC_SITES_N $n
+        ${definitions}
+        static int pallene_allocs_lua(lua_State *L)
+        {
+            static const char *const funcs[PALLENE_ALLOC_SITES_N] = { $funcs };
+            static const char *const kinds[PALLENE_ALLOC_SITES_N] = { $kinds };
+            static const int lines[PALLENE_ALLOC_SITES_N] = { $lines };
+            lua_createtable(L, PALLENE_ALLOC_SITES_N, 0);
+            for (int i = 0; i < PALLENE_ALLOC_SITES_N; i++) {
+                const pallene_alloc_site_t *s = &pallene_alloc_sites[i];
+                lua_createtable(L, 0, 7);
+                lua_pushstring(L, funcs[i]);
+                lua_setfield(L, -2, "func");
+                lua_pushstring(L, kinds[i]);
+                lua_setfield(L, -2, "kind");
+                lua_pushinteger(L, lines[i]);
+                lua_setfield(L, -2, "line");
+                lua_pushinteger(L, (lua_Integer) s->count);
+                lua_setfield(L, -2, "count");
+                lua_pushinteger(L, (lua_Integer) s->bytes);
+                lua_setfield(L, -2, "bytes");
+                lua_pushinteger(L, (lua_Integer) s->gc_steps);
+                lua_setfield(L, -2, "gc_steps");
+                lua_pushnumber(L, s->gc_time / 1e9);
+                lua_setfield(L, -2, "gc_time");
+                lua_seti(L, -2, i + 1);
+            }
+            return 1;
+        }
+    ]], {
+        n = C.integer(#self.alloc_sites),
+        definitions = definitions,
+        funcs = table.concat(funcs, ", "),
+        kinds = table.concat(kinds, ", "),
+        lines = table.concat(lines, ", "),
+    }))
 end
 
 function Coder:generate_luaopen_function()
@@ -1922,6 +3271,12 @@ function Coder:generate_luaopen_function()
                 lua_pushstring(L, $str);]], {
                     str = C.string(upv.str)
                 }))
+        elseif tag == "coder.Constant.Closure" then
+            table.insert(init_constants, util.render([[
+                lua_pushvalue(L, globals);
+                lua_pushcclosure(L, $lua_entry_point, 1);]], {
+                    lua_entry_point = self:lua_entry_point_name(upv.f_id)
+                }))
         -- Will be used if compiling with `--use-traceback`
         elseif tag == "coder.Constant.DebugUserdata" then
             table.insert(init_constants, [[
@@ -1963,6 +3318,68 @@ function Coder:generate_luaopen_function()
 
     assert(#self.constants <= 65535) -- USHRT_MAX
 
+    local stats_functions = {}
+    if self.flags.instrument then
+        table.insert(stats_functions, [[
+            lua_pushcfunction(L, pallene_stats_lua);
+            lua_setfield(L, -2, "__pallene_stats");
+        ]])
+    end
+    if self.flags.instrument_allocs then
+        table.insert(stats_functions, [[
+            lua_pushcfunction(L, pallene_allocs_lua);
+            lua_setfield(L, -2, "__pallene_allocs");
+        ]])
+    end
+    if self.flags.instrument_checks then
+        table.insert(stats_functions, [[
+            lua_pushcfunction(L, pallene_checks_lua);
+            lua_setfield(L, -2, "__pallene_checks");
+        ]])
+    end
+
+    local exports_extras = {}
+
+    -- The batch entry points go in a table of their own, so they can't clash with the exports. We
+    -- check that the export is the one that we expect, before we take its upvalues.
+    if self.flags.batch_entry_points then
+        local batch_functions = {}
+        for _, f_id in ipairs(self.module.exported_functions) do
+            if self.has_batch_entry_point[f_id] then
+                table.insert(batch_functions, util.render([[
+                    lua_getfield(L, -2, $name);
+                    if (lua_tocfunction(L, -1) == $lua_entry_point) {
+                        lua_pushcclosure(L, $batch_entry_point, 1);
+                        lua_setfield(L, -2, $name);
+                    } else {
+                        lua_pop(L, 1);
+                    }
+                ]], {
+                    name = C.string(self.module.functions[f_id].name),
+                    lua_entry_point = self:lua_entry_point_name(f_id),
+                    batch_entry_point = self:batch_entry_point_name(f_id),
+                }))
+            end
+        end
+        table.insert(exports_extras, util.render([[
+            /* Batch entry points */
+            if (lua_istable(L, -1)) {
+                lua_newtable(L);
+                ${register}
+                lua_setfield(L, -2, "__pallene_batch");
+            }
+        ]], { register = concat_lines(batch_functions) }))
+    end
+
+    if #stats_functions > 0 then
+        table.insert(exports_extras, util.render([[
+            /* Instrumentation */
+            if (lua_istable(L, -1)) {
+                ${register}
+            }
+        ]], { register = concat_lines(stats_functions) }))
+    end
+
     return (util.render([[
         int ${name}(lua_State *L)
         {
@@ -1980,6 +3397,7 @@ function Coder:generate_luaopen_function()
             /* Toplevel Module Code */
 
             ${init_initializers}
+            ${exports_extras}
             return 1;
         }
     ]], {
@@ -1987,6 +3405,7 @@ function Coder:generate_luaopen_function()
         n_upvalues = C.integer(#self.constants),
         init_constants = concat_lines(init_constants),
         init_initializers = init_initializers,
+        exports_extras = concat_lines(exports_extras),
     }))
 end
 
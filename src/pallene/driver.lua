@@ -15,7 +15,10 @@ local constant_propagation = require "pallene.constant_propagation"
 local coder = require "pallene.coder"
 local Lexer = require "pallene.Lexer"
 local parser = require "pallene.parser"
+local pass_manager = require "pallene.pass_manager"
+local pgo = require "pallene.pgo"
 local to_ir = require "pallene.to_ir"
+local translation_units = require "pallene.translation_units"
 local uninitialized = require "pallene.uninitialized"
 local util = require "pallene.util"
 local translator = require "pallene.translator"
@@ -46,6 +49,18 @@ function driver.load_input(path)
     return util.get_file_contents(path)
 end
 
+--
+-- The compiler passes, in order. The names are used for stop_after and for -fno-<pass>.
+--
+
+pass_manager.register("ast", parser.parse, {})
+pass_manager.register("typechecker", typechecker.check, {})
+pass_manager.register("assignment_conversion", assignment_conversion.convert, {})
+pass_manager.register("ir", to_ir.convert, { outputs_ir = true })
+pass_manager.register("uninitialized", uninitialized.verify_variables, { outputs_ir = true })
+pass_manager.register("constant_propagation", constant_propagation.run,
+    { outputs_ir = true, optimization = true })
+
 --
 -- Run AST and IR passes, up-to and including the specified pass. This is meant for unit tests.
 --
@@ -54,76 +69,154 @@ end
 --
 -- @opt_level is used here to enable or disable Pallene optimizations. Follows GCC convention of
 -- level "0" being no optimization. Currently, every other level will enable Pallene optimizations.
-function driver.compile_internal(filename, input, stop_after, opt_level)
+--
+-- @flags are the pallenec flags. The pass manager uses flags.disabled_passes, flags.timer and
+-- flags.verify_ir. See pass_manager.run.
+function driver.compile_internal(filename, input, stop_after, opt_level, flags)
     stop_after = stop_after or "optimize"
-
-    local errs
-
-    local function abort()
-        if type(errs) == "string" then errs = { errs } end
-        table.insert(errs, "compilation aborted due to previous error")
-        return false, errs
-    end
+    flags = flags or {}
 
     local lexer = Lexer.new(filename, input)
     if stop_after == "lexer" then return lexer end
 
-    local prog_ast
-    prog_ast, errs = parser.parse(lexer)
-    if not prog_ast then return abort() end
-    if stop_after == "ast" then return prog_ast end
+    return pass_manager.run(lexer, stop_after, opt_level, {
+        disabled = flags.disabled_passes,
+        timer = flags.timer,
+        verify_ir = flags.verify_ir,
+    })
+end
 
-    prog_ast, errs = typechecker.check(prog_ast)
-    if not prog_ast then return abort() end
-    if stop_after == "typechecker" then return prog_ast end
+-- Measures f(...) if the user asked for --time-passes.
+local function measure(flags, name, f, ...)
+    if flags and flags.timer then
+        return flags.timer:measure(name, f, ...)
+    else
+        return f(...)
+    end
+end
 
-    prog_ast, errs = assignment_conversion.convert(prog_ast)
-    if not prog_ast then return abort() end
-    if stop_after == "assignment_conversion" then return prog_ast end
+-- Same as measure, for the steps that run the C compiler.
+local function measure_external(flags, name, f, ...)
+    if flags and flags.timer then
+        return flags.timer:measure_external(name, f, ...)
+    else
+        return f(...)
+    end
+end
 
-    local module
-    module, errs = to_ir.convert(prog_ast)
-    if not module then return abort() end
-    if stop_after == "ir" then return module end
+local function compile_pallene_to_ir(pallene_filename, mod_name, opt_level, flags)
+    local input, err = driver.load_input(pallene_filename)
+    if not input then
+        return false, { err }
+    end
 
-    module, errs = uninitialized.verify_variables(module)
-    if not module then return abort() end
-    if stop_after == "uninitialized" then return module end
+    local module, errs = driver.compile_internal(pallene_filename, input, nil, opt_level, flags)
+    if not module then
+        return false, errs
+    end
 
-    if opt_level > 0 then
-        module, errs = constant_propagation.run(module)
-        if not module then return abort() end
-        if stop_after == "constant_propagation" then return module end
+    if flags.pgo_use then
+        module, errs = pgo.apply_profile(module, flags.pgo_use, mod_name)
+        if not module then
+            return false, errs
+        end
     end
 
-    if stop_after == "optimize" then return module end
-    error("impossible")
+    return module, {}
 end
 
+-- The C code is written straight to the output file as it is generated, instead of building a
+-- string with the whole file first.
 local function compile_pallene_to_c(pallene_filename, c_filename, mod_name, opt_level, flags)
-    local input, err = driver.load_input(pallene_filename)
-    if not input then
+    local module, errs = compile_pallene_to_ir(pallene_filename, mod_name, opt_level, flags)
+    if not module then
+        return false, errs
+    end
+
+    local f, err = io.open(c_filename, "w")
+    if not f then
         return false, { err }
     end
+    measure(flags, "coder", coder.generate_to, f, module, mod_name, pallene_filename, flags)
+    local ok, close_err = f:close()
+    if not ok then
+        return false, { close_err }
+    end
 
-    local module, errs = driver.compile_internal(pallene_filename, input, nil, opt_level)
+    return true, {}
+end
+
+-- Skips the intermediate .c and .o files, by piping the C code into a single C compiler call.
+-- The C compiler runs at the same time as the coder, so the coder's time is a part of it.
+local function compile_pallene_to_so(pallene_filename, so_filename, mod_name, opt_level, flags)
+    local module, errs = compile_pallene_to_ir(pallene_filename, mod_name, opt_level, flags)
     if not module then
         return false, errs
     end
 
-    local c_code
-    c_code, errs = coder.generate(module, mod_name, pallene_filename, flags)
-    if not c_code then
+    local function write_c_code(pipe)
+        measure(flags, "coder", coder.generate_to, pipe, module, mod_name, pallene_filename, flags)
+    end
+    return measure_external(flags, "c_compiler", c_compiler.compile_c_code_to_so,
+        write_c_code, so_filename, flags)
+end
+
+-- Splits the C code into several translation units, which are compiled in parallel. The
+-- intermediate files are created next to a temporary file, so that the units can include the
+-- internal header by its base name.
+local function compile_pallene_to_so_split(pallene_filename, so_filename, mod_name, opt_level,
+                                           flags)
+    local module, errs = compile_pallene_to_ir(pallene_filename, mod_name, opt_level, flags)
+    if not module then
         return false, errs
     end
 
-    local ok
-    ok, err = util.set_file_contents(c_filename, c_code)
-    if not ok then
+    local units = translation_units.partition(module, flags.split_units)
+
+    local base_name = os.tmpname()
+    local header_filename = base_name .. "_internal.h"
+    local c_filenames, o_filenames = {}, {}
+    for i = 1, #units do
+        c_filenames[i] = string.format("%s_%d.c", base_name, i)
+        o_filenames[i] = string.format("%s_%d.o", base_name, i)
+    end
+
+    local function remove_files()
+        os.remove(base_name)
+        os.remove(header_filename)
+        for i = 1, #units do
+            os.remove(c_filenames[i])
+            os.remove(o_filenames[i])
+        end
+    end
+
+    local outputs = {}
+    local header_output, err = io.open(header_filename, "w")
+    for i = 1, #units do
+        if not err then
+            outputs[i], err = io.open(c_filenames[i], "w")
+        end
+    end
+    if err then
+        if header_output then header_output:close() end
+        for _, output in ipairs(outputs) do output:close() end
+        remove_files()
         return false, { err }
     end
 
-    return true, {}
+    local header_basename = string.match(header_filename, "[^/]*$")
+    measure(flags, "coder", coder.generate_units_to, header_output, outputs, header_basename,
+        units, module, mod_name, pallene_filename, flags)
+    header_output:close()
+    for _, output in ipairs(outputs) do
+        output:close()
+    end
+
+    local ok
+    ok, errs = measure_external(flags, "c_compiler", c_compiler.compile_units_to_so,
+        c_filenames, o_filenames, so_filename, flags.jobs or util.number_of_cpus(), flags)
+    remove_files()
+    return ok, errs
 end
 
 local compiler_steps = {
@@ -200,6 +293,24 @@ local function compile_pln_to_d_pln(input_ext, output_ext, input_file_name, base
     return true, {}
 end
 
+-- The header of the C API, for --emit-c-api. It only depends on the exported functions, so we don't
+-- need to optimize the module. See the C API section in coder.lua.
+local function compile_pln_to_c_api_header(input_file_name, base_name, mod_name, opt_level, flags)
+    local input, err = driver.load_input(input_file_name)
+    if not input then
+        return false, { err }
+    end
+
+    local module, errs = driver.compile_internal(input_file_name, input, "ir", opt_level, flags)
+    if not module then
+        return false, errs
+    end
+
+    local header = coder.generate_c_api_header(module, mod_name)
+    assert(util.set_file_contents(base_name .. "_api.h", header))
+    return true, {}
+end
+
 function driver.compile_internal_d_pln(filename, input, stop_after)
     stop_after = stop_after or "typechecker"
 
@@ -258,7 +369,38 @@ function driver.compile(argv0, opt_level, input_ext, output_ext,
 
     local mod_name = string.gsub(output_base_name, "/", "_")
 
-    if output_ext == "lua" then
+    local uses_pgo = flags.pgo_generate or flags.pgo_use
+
+    if flags.emit_c_api and input_ext == "pln" and (output_ext == "c" or output_ext == "so") then
+        local ok, errs = compile_pln_to_c_api_header(input_file_name, output_base_name, mod_name,
+            opt_level, flags)
+        if not ok then return false, errs end
+    end
+
+    if flags.pgo_use and output_ext == "so" then
+        local ok, errs = c_compiler.merge_profiles(flags.pgo_use)
+        if not ok then return false, errs end
+    end
+
+    -- The C compiler's profiles refer to the names of the .c and .o files, so we can't split the
+    -- module, use the single invocation mode, or use random temporary names when doing PGO.
+    if input_ext == "pln" and output_ext == "so" and (flags.split_units or 1) > 1 and
+        not uses_pgo then
+        local ok, errs = compile_pallene_to_so_split(input_file_name, output_file_name, mod_name,
+            opt_level, flags)
+        if ok then
+            ok, errs = compile_pln_to_d_pln("pln", "d.pln", input_file_name, output_base_name)
+        end
+        return ok, errs
+    elseif input_ext == "pln" and output_ext == "so" and flags.single_invocation and
+        not uses_pgo then
+        local ok, errs = compile_pallene_to_so(input_file_name, output_file_name, mod_name,
+            opt_level, flags)
+        if ok then
+            ok, errs = compile_pln_to_d_pln("pln", "d.pln", input_file_name, output_base_name)
+        end
+        return ok, errs
+    elseif output_ext == "lua" then
         return compile_pln_to_lua(input_ext, output_ext, input_file_name, output_base_name)
     elseif output_ext == "d.pln" then
         return compile_pln_to_d_pln(input_ext, output_ext, input_file_name, output_base_name)
@@ -274,6 +416,8 @@ function driver.compile(argv0, opt_level, input_ext, output_ext,
                 file_names[i] = input_base_name .. "." .. step.name
             elseif i == last_step then
                 file_names[i] = output_base_name .. "." .. step.name
+            elseif uses_pgo then
+                file_names[i] = output_base_name .. ".pgo." .. step.name
             else
                 file_names[i] = os.tmpname()
             end
@@ -284,7 +428,12 @@ function driver.compile(argv0, opt_level, input_ext, output_ext,
             local f = compiler_steps[i].f
             local src = file_names[i]
             local out = file_names[i+1]
-            ok, errs = f(src, out, mod_name, opt_level, flags)
+            if compiler_steps[i].name == "pln" then
+                ok, errs = f(src, out, mod_name, opt_level, flags)
+            else
+                ok, errs = measure_external(flags, "c_compiler", f, src, out, mod_name,
+                    opt_level, flags)
+            end
             if not ok then break end
         end
 
@@ -53,6 +53,7 @@
 
 local flow = {}
 
+local bitset = require "pallene.bitset"
 local ir = require "pallene.ir"
 local tagged_union = require "pallene.tagged_union"
 local define_union = tagged_union.in_namespace(flow, "flow")
@@ -70,14 +71,6 @@ function flow.GenKill()
 end
 
 
-local function FlowState()
-    return {
-        start  = {},   -- set of values when we start analysing the block
-        finish = {},   -- set of values when we finish analysing the block,
-        gk     = flow.GenKill(),
-    }
-end
-
 function flow.FlowInfo(order, compute_gen_kill, init_start)
     return {
         -- "order" is the order in which commands and blocks are iterated during flow analysis.
@@ -102,59 +95,6 @@ function flow.FlowInfo(order, compute_gen_kill, init_start)
     }
 end
 
-local function apply_gen_kill_sets(flow_state)
-    local start = flow_state.start
-    local finish = flow_state.finish
-    local gen = flow_state.gk.gen
-    local kill = flow_state.gk.kill
-    local in_changed = false
-
-    for v, _ in pairs(start) do
-        local val = true
-        if kill[v] then
-            val = nil
-        end
-        local previous_val = finish[v]
-        local new_val = previous_val or val
-        finish[v] = new_val
-        in_changed = in_changed or (previous_val ~= new_val)
-    end
-
-    for v, g in pairs(gen) do
-        assert(not (g and kill[v]), "gen and kill can't both be true")
-        local previous_val = finish[v]
-        local new_val = true
-        finish[v] = new_val
-        in_changed = in_changed or (previous_val ~= new_val)
-    end
-
-    for v, _ in pairs(finish) do
-        if not start[v] and not gen[v] then
-            finish[v] = nil
-            in_changed = true
-        end
-    end
-
-    return in_changed
-end
-
-local function clear_set(S)
-    for v,_ in pairs(S) do
-        S[v] = nil
-    end
-end
-
-local function merge_sets(state_list, src_indices, dest_index)
-    local dest = state_list[dest_index].start
-    clear_set(dest)
-    for _,src_i in ipairs(src_indices) do
-        local src = state_list[src_i].finish
-        for v, _ in pairs(src) do
-            dest[v] = true
-        end
-    end
-end
-
 local function apply_cmd_gk_to_block_gk(cmd_gk, block_gk)
     local cmd_gen = cmd_gk.gen
     local cmd_kill = cmd_gk.kill
@@ -172,37 +112,119 @@ local function apply_cmd_gk_to_block_gk(cmd_gk, block_gk)
     end
 end
 
-local function make_state_list(block_list, flow_info)
-    local state_list = {}
+local function max_element(set, max)
+    for v, _ in pairs(set) do
+        assert(math.type(v) == "integer" and v >= 1, "set elements must be positive integers")
+        if v > max then max = v end
+    end
+    return max
+end
+
+-- Computes the combined gen and kill sets of each block, and its initial start set. These are
+-- still Lua sets, which we convert to bitsets once we know how large the bitsets must be.
+local function make_block_sets(block_list, flow_info)
+    local start_list = {}
+    local gk_list = {}
+    local max_value = 0
     local order = flow_info.order._tag
     for block_i, block in ipairs(block_list) do
-        local block_state = FlowState()
-        state_list[block_i] = block_state
-        flow_info.init_start(block_state.start, block_i)
+        local start = {}
+        flow_info.init_start(start, block_i)
+        local block_gk = flow.GenKill()
         if order == "flow.Order.Forward" then
             for cmd_i = 1, #block.cmds do
                 local cmd_gk = flow_info.compute_gen_kill(block_i, cmd_i)
-                apply_cmd_gk_to_block_gk(cmd_gk, block_state.gk)
+                apply_cmd_gk_to_block_gk(cmd_gk, block_gk)
             end
         elseif order == "flow.Order.Backwards" then
             for cmd_i = #block.cmds, 1, -1  do
                 local cmd_gk = flow_info.compute_gen_kill(block_i, cmd_i)
-                apply_cmd_gk_to_block_gk(cmd_gk, block_state.gk)
+                apply_cmd_gk_to_block_gk(cmd_gk, block_gk)
             end
         else
             tagged_union.error(order)
         end
+        start_list[block_i] = start
+        gk_list[block_i] = block_gk
+        max_value = max_element(start, max_value)
+        max_value = max_element(block_gk.gen, max_value)
+        max_value = max_element(block_gk.kill, max_value)
     end
-    return state_list
+    return start_list, gk_list, max_value
+end
+
+-- A priority queue of blocks, where the block that comes first in the iteration order has the
+-- highest priority. Processing the blocks in this order means that, in the common case, a block is
+-- only processed after all of its predecessors (or successors, for a backwards analysis).
+local function Worklist(block_order)
+    local position = {} -- { block_id => integer? } position in the iteration order
+    for pos, block_i in ipairs(block_order) do
+        position[block_i] = pos
+    end
+
+    local heap = {}      -- binary heap of positions
+    local in_heap = {}   -- { position => bool? }
+
+    local function push(block_i)
+        local pos = position[block_i]
+        if not pos or in_heap[pos] then return end -- Unreachable or already there
+        in_heap[pos] = true
+        local i = #heap + 1
+        heap[i] = pos
+        while i > 1 do
+            local parent = i // 2
+            if heap[parent] <= heap[i] then break end
+            heap[parent], heap[i] = heap[i], heap[parent]
+            i = parent
+        end
+    end
+
+    local function pop()
+        local n = #heap
+        if n == 0 then return false end
+        local top = heap[1]
+        heap[1] = heap[n]
+        heap[n] = nil
+        n = n - 1
+        local i = 1
+        while true do
+            local smallest = i
+            local l, r = 2 * i, 2 * i + 1
+            if l <= n and heap[l] < heap[smallest] then smallest = l end
+            if r <= n and heap[r] < heap[smallest] then smallest = r end
+            if smallest == i then break end
+            heap[smallest], heap[i] = heap[i], heap[smallest]
+            i = smallest
+        end
+        in_heap[top] = nil
+        return block_order[top]
+    end
+
+    return push, pop
 end
 
 -- Does flow analysis on a list of ir.BasicBlock objects. "block_list" is the list of blocks and
 -- "flow_info" is an object of type flow.FlowInfo which contains information about how the flow
 -- analysis will be done. The function returns the list of starting sets, each set in the list
 -- corresponds to the basic block indexed by the same value.
+--
+-- Internally, the sets are represented as bitsets (see bitset.lua), and the blocks are processed
+-- with a worklist that follows the reverse postorder of the control flow graph.
 function flow.flow_analysis(block_list, flow_info)
                                -- ({ir.BasicBlock}, flow.FlowInfo) -> { block_id -> set }
-    local state_list = make_state_list(block_list, flow_info)
+    local start_sets, gk_sets, max_value = make_block_sets(block_list, flow_info)
+    local nwords = bitset.nwords(max_value)
+
+    local start_list  = {} -- { block_id -> bitset }
+    local finish_list = {} -- { block_id -> bitset }
+    local gen_list    = {} -- { block_id -> bitset }
+    local kill_list   = {} -- { block_id -> bitset }
+    for block_i = 1, #block_list do
+        start_list[block_i]  = bitset.from_set(start_sets[block_i], nwords)
+        finish_list[block_i] = bitset.new(nwords)
+        gen_list[block_i]    = bitset.from_set(gk_sets[block_i].gen, nwords)
+        kill_list[block_i]   = bitset.from_set(gk_sets[block_i].kill, nwords)
+    end
 
     local succ_list = ir.get_successor_list(block_list)
     local pred_list = ir.get_predecessor_list(block_list)
@@ -223,48 +245,57 @@ function flow.flow_analysis(block_list, flow_info)
         tagged_union.error(order)
     end
 
-    local dirty_flag = {} -- { block_id -> bool } keeps track of modified blocks
-    for i = 1, #block_list do
-        dirty_flag[i] = true
+    local push, pop = Worklist(block_order)
+    for _, block_i in ipairs(block_order) do
+        push(block_i)
     end
 
     local first_block_i = block_order[1]
 
     local function update_block(block_i)
-        local state = state_list[block_i]
+        local start = start_list[block_i]
 
         -- first block's starting set is supposed to be constant
         if block_i ~= first_block_i then
-            local src_indices = merge_src_list[block_i]
-            merge_sets(state_list, src_indices, block_i)
+            for w = 1, nwords do
+                start[w] = 0
+            end
+            for _, src_i in ipairs(merge_src_list[block_i]) do
+                bitset.union_into(start, finish_list[src_i])
+            end
         end
 
-        local dirty_propagation = dirty_propagation_list[block_i]
-        local state_changed = apply_gen_kill_sets(state)
-        if state_changed then
-            for _, i in ipairs(dirty_propagation) do
-                dirty_flag[i] = true
+        -- finish = gen U (start - kill)
+        local finish = finish_list[block_i]
+        local gen = gen_list[block_i]
+        local kill = kill_list[block_i]
+        local changed = false
+        for w = 1, nwords do
+            local new = gen[w] | (start[w] & ~kill[w])
+            if new ~= finish[w] then
+                finish[w] = new
+                changed = true
             end
         end
-    end
 
-    repeat
-        local found_dirty_block = false
-        for _,block_i in ipairs(block_order) do
-            if dirty_flag[block_i] then
-                found_dirty_block = true
-                -- CAREFUL: we have to clean the dirty flag BEFORE updating the block or else a
-                -- block that jumps to itself might set it's dirty flag to "true" during
-                -- "update_block" and we'll then wrongly set it to "false" in here.
-                dirty_flag[block_i] = false
-                update_block(block_i)
+        if changed then
+            for _, i in ipairs(dirty_propagation_list[block_i]) do
+                push(i)
             end
         end
-    until not found_dirty_block
+    end
+
+    -- CAREFUL: the block is removed from the worklist BEFORE it is updated. Otherwise, a block that
+    -- jumps to itself would not be added back to the worklist when its own finish set changes.
+    while true do
+        local block_i = pop()
+        if not block_i then break end
+        update_block(block_i)
+    end
 
     local block_start_list = {}
-    for state_i, flow_state in ipairs(state_list) do
-        block_start_list[state_i] = flow_state.start
+    for block_i, start in ipairs(start_list) do
+        block_start_list[block_i] = bitset.to_set(start)
     end
 
     return block_start_list
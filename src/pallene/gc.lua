@@ -3,6 +3,7 @@
 -- Please refer to the LICENSE and AUTHORS files for details
 -- SPDX-License-Identifier: MIT
 
+local bitset = require "pallene.bitset"
 local ir = require "pallene.ir"
 local flow = require "pallene.flow"
 local types = require "pallene.types"
@@ -95,7 +96,8 @@ local function compute_stack_slots(func)
     -- 2) Find which GC'd variables are live at each GC spot in the program and
     --    which  GC'd variables are live at the same time
     local live_gc_vars = {} -- { block_id => { cmd_id => {var_id}? } }
-    local live_at_same_time = {} -- { var_id => { var_id => bool? }? }
+    local live_at_same_time = {} -- { var_id => bitset? }
+    local nwords = bitset.nwords(#func.vars)
 
     -- initialize live_gc_vars
     for _, block in ipairs(func.blocks) do
@@ -116,14 +118,22 @@ local function compute_stack_slots(func)
                 for var,_ in pairs(lives_block) do
                     table.insert(lives_cmd, var)
                 end
+                table.sort(lives_cmd)
                 live_gc_vars[block_i][cmd_i] = lives_cmd
-                for var1,_ in pairs(lives_block) do
-                    for var2,_ in pairs(lives_block) do
-                        if not live_at_same_time[var1] then
-                            live_at_same_time[var1] = {}
-                        end
-                        live_at_same_time[var1][var2] = true
+
+                -- Using bitsets, this is linear on the number of live variables, instead of
+                -- quadratic. This matters for functions with thousands of temporaries.
+                local lives_bitset = bitset.new(nwords)
+                for _, var in ipairs(lives_cmd) do
+                    bitset.add(lives_bitset, var)
+                end
+                for _, var in ipairs(lives_cmd) do
+                    local set = live_at_same_time[var]
+                    if not set then
+                        set = bitset.new(nwords)
+                        live_at_same_time[var] = set
                     end
+                    bitset.union_into(set, lives_bitset)
                 end
             end
         end
@@ -140,22 +150,25 @@ local function compute_stack_slots(func)
         slot_of_variable[v_id] = false
     end
 
-    for v1, set in pairs(live_at_same_time) do
-        local taken_slots = {}  -- { stack_slot => bool? }
-        for v2,_ in pairs(set) do
-            local v2_slot = slot_of_variable[v2]
-            if v2_slot then
-                taken_slots[v2_slot] = true
+    for v1 = 1, #func.vars do
+        local set = live_at_same_time[v1]
+        if set then
+            local taken_slots = {}  -- { stack_slot => bool? }
+            for _, v2 in ipairs(bitset.elements(set)) do
+                local v2_slot = slot_of_variable[v2]
+                if v2_slot then
+                    taken_slots[v2_slot] = true
+                end
             end
-        end
-        for slot = 0, #func.vars do
-            if not taken_slots[slot] then
-                slot_of_variable[v1] = slot
-                max_frame_size = math.max(max_frame_size, slot + 1)
-                break
+            for slot = 0, #func.vars do
+                if not taken_slots[slot] then
+                    slot_of_variable[v1] = slot
+                    max_frame_size = math.max(max_frame_size, slot + 1)
+                    break
+                end
             end
+            assert(slot_of_variable[v1], "should always find a slot")
         end
-        assert(slot_of_variable[v1], "should always find a slot")
     end
 
     return live_gc_vars, max_frame_size, slot_of_variable
@@ -247,15 +260,34 @@ local function compute_vars_to_mirror(func)
             block_defs[cmd_i] = {}
         end
     end
+    -- Once a definition has been marked, we don't need to look at it again. Instead of the full set
+    -- of reaching definitions, we only keep track of the ones that are not marked yet. Otherwise,
+    -- this would be quadratic in functions with many definitions and many GC sites.
+    local is_marked = {} -- { def_id => bool? }
     for block_i, block in ipairs(func.blocks) do
-        local defs_block = sets_list[block_i]
+        local pending = {} -- reaching definitions that are not marked yet
+        for def_i, _ in pairs(sets_list[block_i]) do
+            if not is_marked[def_i] then
+                pending[def_i] = true
+            end
+        end
         for cmd_i, cmd in ipairs(block.cmds) do
-            flow.update_set(defs_block, flow_info, block_i, cmd_i)
+            local gk = compute_gen_kill(block_i, cmd_i)
+            for def_i, _ in pairs(gk.kill) do
+                pending[def_i] = nil
+            end
+            for def_i, _ in pairs(gk.gen) do
+                if not is_marked[def_i] then
+                    pending[def_i] = true
+                end
+            end
             if cmd_uses_gc(cmd) then
-                for def_i, _ in pairs(defs_block) do
+                for def_i, _ in pairs(pending) do
                     local def = def_list[def_i]
                     vars_to_mirror[def.block_i][def.cmd_i][def.var_i] = true
+                    is_marked[def_i] = true
                 end
+                pending = {}
             end
         end
     end
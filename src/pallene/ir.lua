@@ -66,6 +66,8 @@ function ir.Function(loc, name, typ)
         blocks = {},          -- { ir.BasicBlock }
         ret_vars = {},        -- { v_id }, list of return variables
         for_loops = {},       -- { ir.ForLoop }
+        block_counts = false, -- { block_id => integer }, see pgo.lua
+        true_counts = false,  -- { block_id => integer }, see pgo.lua
     }
 end
 
@@ -278,6 +280,18 @@ function ir.get_srcs(cmd)
     return srcs
 end
 
+-- The f_id of the function called by an ir.Cmd.CallStatic, or nil if we don't know it.
+function ir.static_callee(func, cmd)
+    local f_val = cmd.src_f
+    if f_val._tag == "ir.Value.Upvalue" then
+        return func.f_id_of_upvalue[f_val.id]
+    elseif f_val._tag == "ir.Value.LocalVar" then
+        return func.f_id_of_local[f_val.id]
+    else
+        return nil
+    end
+end
+
 -- Returns the outputs of the given command, a list of local variable IDs.
 -- The order is the same order used by the constructor.
 function ir.get_dsts(cmd)
@@ -0,0 +1,141 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- IR VERIFIER
+-- ===========
+-- Checks that an ir.Module is well formed: that every variable, upvalue, function and block that
+-- is referenced actually exists, and that jumps only appear at the end of a basic block. This is a
+-- debugging aid for compiler developers. A bug in an optimization pass is much easier to find if
+-- we catch it right after that pass, instead of as a C compiler error or a crash at run-time.
+
+local ir = require "pallene.ir"
+local tagged_union = require "pallene.tagged_union"
+
+local ir_verifier = {}
+
+local function in_range(x, n)
+    return math.type(x) == "integer" and 1 <= x and x <= n
+end
+
+local function verify_function(module, f_id, func, errors)
+    local function err(fmt, ...)
+        table.insert(errors, string.format("function %d (%s): ", f_id, func.name) ..
+            string.format(fmt, ...))
+    end
+
+    local nvars = #func.vars
+    local nblocks = #func.blocks
+
+    if nblocks == 0 then
+        err("has no basic blocks")
+    end
+
+    local function check_value(where, value)
+        if type(value) ~= "table" or tagged_union.typename(value._tag) ~= "ir.Value" then
+            err("%s: source is not an ir.Value", where)
+        elseif value._tag == "ir.Value.LocalVar" then
+            if not in_range(value.id, nvars) then
+                err("%s: reads undefined variable x%s", where, tostring(value.id))
+            end
+        elseif value._tag == "ir.Value.Upvalue" then
+            if not in_range(value.id, #func.captured_vars) then
+                err("%s: reads undefined upvalue U%s", where, tostring(value.id))
+            end
+        end
+    end
+
+    local function check_block_id(where, b)
+        if not in_range(b, nblocks) then
+            err("%s: jumps to nonexistent block %s", where, tostring(b))
+        end
+    end
+
+    local function check_f_id(where, id)
+        if not in_range(id, #module.functions) then
+            err("%s: refers to nonexistent function %s", where, tostring(id))
+        end
+    end
+
+    local function check_cmd(where, cmd, is_last)
+        for _, src in ipairs(ir.get_srcs(cmd)) do
+            check_value(where, src)
+        end
+        for _, dst in ipairs(ir.get_dsts(cmd)) do
+            if not in_range(dst, nvars) then
+                err("%s: writes to undefined variable x%s", where, tostring(dst))
+            end
+        end
+
+        local tag = cmd._tag
+        if ir.is_jump(cmd) and not is_last then
+            err("%s: jump in the middle of a basic block", where)
+        end
+        if tag == "ir.Cmd.Jmp" then
+            check_block_id(where, cmd.target)
+        elseif tag == "ir.Cmd.JmpIf" then
+            check_block_id(where, cmd.target_true)
+            check_block_id(where, cmd.target_false)
+        elseif tag == "ir.Cmd.NewClosure" or tag == "ir.Cmd.InitUpvalues" then
+            check_f_id(where, cmd.f_id)
+        end
+    end
+
+    for block_i, block in ipairs(func.blocks) do
+        for cmd_i, cmd in ipairs(block.cmds) do
+            local where = string.format("block %d, command %d", block_i, cmd_i)
+            if type(cmd) ~= "table" or tagged_union.typename(cmd._tag) ~= "ir.Cmd" then
+                err("%s: is not an ir.Cmd", where)
+            else
+                check_cmd(where, cmd, cmd_i == #block.cmds)
+            end
+        end
+    end
+
+    for _, v_id in ipairs(func.ret_vars) do
+        if not in_range(v_id, nvars) then
+            err("return variable x%s does not exist", tostring(v_id))
+        end
+    end
+
+    for v_id, id in pairs(func.f_id_of_local) do
+        if not in_range(v_id, nvars) then
+            err("f_id_of_local refers to undefined variable x%s", tostring(v_id))
+        end
+        check_f_id("f_id_of_local", id)
+    end
+    for u_id, id in pairs(func.f_id_of_upvalue) do
+        if not in_range(u_id, #func.captured_vars) then
+            err("f_id_of_upvalue refers to undefined upvalue U%s", tostring(u_id))
+        end
+        check_f_id("f_id_of_upvalue", id)
+    end
+
+    for i, loop in ipairs(func.for_loops) do
+        local where = string.format("for loop %d", i)
+        check_block_id(where, loop.prep_block_id)
+        check_block_id(where, loop.body_first_block_id)
+        check_block_id(where, loop.body_last_block_id)
+    end
+end
+
+-- Returns true, or false and a list of error messages.
+function ir_verifier.verify(module)
+    local errors = {}
+    for f_id, func in ipairs(module.functions) do
+        verify_function(module, f_id, func, errors)
+    end
+    for _, f_id in ipairs(module.exported_functions) do
+        if not in_range(f_id, #module.functions) then
+            table.insert(errors, string.format("exported function %s does not exist", f_id))
+        end
+    end
+
+    if #errors > 0 then
+        return false, errors
+    end
+    return true, {}
+end
+
+return ir_verifier
@@ -0,0 +1,261 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- JSON
+-- ====
+-- A small JSON encoder and decoder, for the machine-readable output of our tools. We don't want to
+-- add a dependency just for this.
+--
+-- Lua tables are encoded as JSON arrays if their keys are 1..n, and as objects otherwise. The empty
+-- table becomes an empty array. Object keys are sorted, so the output is deterministic. JSON null
+-- decodes to json.null, so that it can be stored in a table.
+
+local util = require "pallene.util"
+
+local json = {}
+
+json.null = setmetatable({}, { __tostring = function() return "null" end })
+
+--
+-- Encoding
+--
+
+local escapes = {
+    ['"'] = '\\"', ['\\'] = '\\\\', ['\b'] = '\\b', ['\f'] = '\\f',
+    ['\n'] = '\\n', ['\r'] = '\\r', ['\t'] = '\\t',
+}
+
+local function encode_string(s)
+    return '"' .. string.gsub(s, '[%c"\\]', function(c)
+        return escapes[c] or string.format("\\u%04x", string.byte(c))
+    end) .. '"'
+end
+
+local function is_array(t)
+    local n = 0
+    for _, _ in pairs(t) do n = n + 1 end
+    for i = 1, n do
+        if t[i] == nil then return false end
+    end
+    return true
+end
+
+local encode_value
+
+local function encode_table(t, indent, depth, out)
+    local nl, pad, pad_end, sep
+    if indent then
+        nl = "\n"
+        pad = string.rep(indent, depth + 1)
+        pad_end = string.rep(indent, depth)
+        sep = ": "
+    else
+        nl, pad, pad_end, sep = "", "", "", ":"
+    end
+
+    if next(t) == nil then
+        table.insert(out, "[]")
+    elseif is_array(t) then
+        table.insert(out, "[" .. nl)
+        for i, v in ipairs(t) do
+            table.insert(out, pad)
+            encode_value(v, indent, depth + 1, out)
+            table.insert(out, (i < #t and "," or "") .. nl)
+        end
+        table.insert(out, pad_end .. "]")
+    else
+        local keys = {}
+        for k, _ in pairs(t) do
+            if type(k) ~= "string" then
+                error("json: object keys must be strings")
+            end
+            table.insert(keys, k)
+        end
+        table.sort(keys)
+        table.insert(out, "{" .. nl)
+        for i, k in ipairs(keys) do
+            table.insert(out, pad .. encode_string(k) .. sep)
+            encode_value(t[k], indent, depth + 1, out)
+            table.insert(out, (i < #keys and "," or "") .. nl)
+        end
+        table.insert(out, pad_end .. "}")
+    end
+end
+
+encode_value = function(v, indent, depth, out)
+    local tv = type(v)
+    if v == nil or v == json.null then
+        table.insert(out, "null")
+    elseif tv == "boolean" then
+        table.insert(out, tostring(v))
+    elseif tv == "number" then
+        if math.type(v) == "integer" then
+            table.insert(out, string.format("%d", v))
+        elseif v ~= v or v == math.huge or v == -math.huge then
+            table.insert(out, "null")
+        else
+            table.insert(out, string.format("%.17g", v))
+        end
+    elseif tv == "string" then
+        table.insert(out, encode_string(v))
+    elseif tv == "table" then
+        encode_table(v, indent, depth, out)
+    else
+        error("json: cannot encode a value of type " .. tv)
+    end
+end
+
+-- @param indent: If present, pretty print the output using this string for each indentation level.
+function json.encode(value, indent)
+    local out = {}
+    encode_value(value, indent, 0, out)
+    return table.concat(out)
+end
+
+--
+-- Decoding
+--
+
+local Decoder = util.Class()
+
+function Decoder:init(s)
+    self.s = s
+    self.pos = 1
+end
+
+function Decoder:error(msg)
+    error({ json_error = string.format("json: %s at position %d", msg, self.pos) })
+end
+
+function Decoder:skip_space()
+    self.pos = string.find(self.s, "[^ \t\r\n]", self.pos) or (#self.s + 1)
+end
+
+function Decoder:peek()
+    self:skip_space()
+    return string.sub(self.s, self.pos, self.pos)
+end
+
+function Decoder:expect(str)
+    self:skip_space()
+    if string.sub(self.s, self.pos, self.pos + #str - 1) ~= str then
+        self:error(string.format("expected '%s'", str))
+    end
+    self.pos = self.pos + #str
+end
+
+function Decoder:string()
+    self:expect('"')
+    local parts = {}
+    while true do
+        local i, j, chunk, special = string.find(self.s, '^([^"\\]*)(["\\])', self.pos)
+        if not i then self:error("unterminated string") end
+        table.insert(parts, chunk)
+        self.pos = j + 1
+        if special == '"' then
+            break
+        end
+        local c = string.sub(self.s, self.pos, self.pos)
+        if c == "u" then
+            local hex = string.match(self.s, "^%x%x%x%x", self.pos + 1)
+            if not hex then self:error("invalid unicode escape") end
+            table.insert(parts, utf8.char(tonumber(hex, 16)))
+            self.pos = self.pos + 5
+        else
+            local unescaped = ({
+                ['"'] = '"', ['\\'] = '\\', ['/'] = '/', b = '\b', f = '\f', n = '\n', r = '\r',
+                t = '\t',
+            })[c]
+            if not unescaped then self:error("invalid escape") end
+            table.insert(parts, unescaped)
+            self.pos = self.pos + 1
+        end
+    end
+    return table.concat(parts)
+end
+
+function Decoder:value()
+    local c = self:peek()
+    if c == "{" then
+        self.pos = self.pos + 1
+        local obj = {}
+        if self:peek() == "}" then
+            self.pos = self.pos + 1
+            return obj
+        end
+        repeat
+            if self:peek() ~= '"' then self:error("expected a string key") end
+            local k = self:string()
+            self:expect(":")
+            obj[k] = self:value()
+            local sep = self:peek()
+            self.pos = self.pos + 1
+        until sep ~= ","
+        if string.sub(self.s, self.pos - 1, self.pos - 1) ~= "}" then
+            self.pos = self.pos - 1
+            self:error("expected '}'")
+        end
+        return obj
+    elseif c == "[" then
+        self.pos = self.pos + 1
+        local arr = {}
+        if self:peek() == "]" then
+            self.pos = self.pos + 1
+            return arr
+        end
+        repeat
+            table.insert(arr, self:value())
+            local sep = self:peek()
+            self.pos = self.pos + 1
+        until sep ~= ","
+        if string.sub(self.s, self.pos - 1, self.pos - 1) ~= "]" then
+            self.pos = self.pos - 1
+            self:error("expected ']'")
+        end
+        return arr
+    elseif c == '"' then
+        return self:string()
+    elseif string.match(c, "[-0-9]") then
+        local num = string.match(self.s, "^-?%d+%.?%d*[eE]?[-+]?%d*", self.pos)
+        local v = tonumber(num)
+        if v and string.match(num, "^-?%d+$") then
+            v = math.tointeger(v) or v
+        end
+        if not v then self:error("invalid number") end
+        self.pos = self.pos + #num
+        return v
+    elseif string.sub(self.s, self.pos, self.pos + 3) == "true" then
+        self.pos = self.pos + 4
+        return true
+    elseif string.sub(self.s, self.pos, self.pos + 4) == "false" then
+        self.pos = self.pos + 5
+        return false
+    elseif string.sub(self.s, self.pos, self.pos + 3) == "null" then
+        self.pos = self.pos + 4
+        return json.null
+    else
+        self:error("unexpected character")
+    end
+end
+
+-- Returns the decoded value, or false and an error message.
+function json.decode(s)
+    local decoder = Decoder.new(s)
+    local ok, result = pcall(function()
+        local v = decoder:value()
+        decoder:skip_space()
+        if decoder.pos <= #s then decoder:error("trailing characters") end
+        return v
+    end)
+    if ok then
+        return result
+    elseif type(result) == "table" and result.json_error then
+        return false, result.json_error
+    else
+        error(result, 0)
+    end
+end
+
+return json
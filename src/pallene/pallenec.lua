@@ -8,7 +8,11 @@
 -- This is the main entry point for the pallenec compiler
 
 local argparse = require "argparse"
+local build_cache = require "pallene.build_cache"
+local coder = require "pallene.coder"
 local driver = require "pallene.driver"
+local json = require "pallene.json"
+local pass_manager = require "pallene.pass_manager"
 local print_ir = require "pallene.print_ir"
 local util = require "pallene.util"
 local type_extractor = require "pallene.type_extractor"
@@ -23,7 +27,7 @@ local compiler_name = arg[0]
 local opts
 do
     local p = argparse("pallenec", "Pallene compiler")
-    p:argument("source_file", "File to compile")
+    p:argument("source_files", "Files to compile"):args("+")
 
     -- What the compiler should output.
     p:mutex(
@@ -33,11 +37,49 @@ do
         p:flag("--compile-c",    "Compile a .c file generated by --emit-c"),
         p:flag("--only-check",   "Check for syntax or type errors, without compiling"),
         p:flag("--print-ir",     "Show the intermediate representation for a program"),
+        p:flag("--remarks",      "Show the runtime checks that remain in each line, as JSON"),
         p:flag("--print-types",   "Show the types of all exported names in the program, without compiling")
     )
 
     -- No Pallene tracebacks
-    p:flag("--use-traceback",    "Enable call-stack tracing")
+    p:mutex(
+        p:flag("--use-traceback",    "Enable call-stack tracing"),
+        p:flag("--use-lite-traceback",
+            "Enable a cheaper call-stack tracing, without to-be-closed finalizers")
+    )
+
+    p:flag("--instrument",
+        "Count the calls and measure the time of each function, see __pallene_stats in the README")
+    p:flag("--instrument-allocs",
+        "Count the allocations and GC time of each line, see __pallene_allocs in the README")
+    p:flag("--instrument-checks",
+        "Count how many times each runtime check runs, see __pallene_checks in the README")
+    p:flag("--batch-entry-points",
+        "Export versions of the functions that loop over arrays, see __pallene_batch in the README")
+    p:flag("--emit-c-api",
+        "Also write a foo_api.h header, to call the exported functions from C")
+
+    -- How to call the C compiler
+    p:flag("--pipe", "Compile and link in a single C compiler call, without temporary files")
+    p:flag("--lto", "Enable link-time optimization in the C compiler (-flto)")
+    p:option("--split-units", "Split the C code into this many files, and compile them in parallel")
+        :args(1):convert(function(s) return math.tointeger(tonumber(s)) end)
+
+    -- Profile guided optimization. See pgo.lua
+    p:mutex(
+        p:option("--pgo-generate",
+            "Build an instrumented module, that saves a profile to this directory")
+            :args("?"),
+        p:option("--pgo-use", "Optimize using the profile saved in this directory")
+            :args(1)
+    )
+
+    -- Compiler passes. See pass_manager.lua
+    p:option("-f", "Disable an optimization pass. For example, -fno-constant-propagation. "..
+        "Optimization passes: " .. table.concat(pass_manager.optimization_passes(), ", "))
+        :args(1):count("*")
+    p:flag("--time-passes", "Show how much time and memory each compiler pass used")
+    p:flag("--verify-ir", "Check the intermediate representation after each pass")
 
     p:option("-O", "Optimization level")
         :args(1):convert(tonumber)
@@ -46,36 +88,227 @@ do
 
     p:option("-o --output", "Output file path")
 
+    -- Building several modules at once
+    p:option("-j --jobs", "How many files to compile in parallel (default: number of CPUs)")
+        :args(1):convert(tonumber)
+    p:option("--cache-dir", "Reuse previously compiled modules from this directory "..
+        "(default: $PALLENE_CACHE_DIR)")
+
     opts = p:parse()
+    opts.source_file = opts.source_files[1]
 end
 
-local function compile(in_ext, out_ext, flags)
-    local ok, errs = driver.compile(compiler_name, opts.O, in_ext, out_ext, opts.source_file,
-        opts.output, flags)
+local function compile_file(source_file, output, in_ext, out_ext, flags)
+    local ok, errs = driver.compile(compiler_name, opts.O, in_ext, out_ext, source_file,
+        output, flags)
     if not ok then util.abort(table.concat(errs, "\n")) end
 end
 
-local function compile_up_to(stop_after)
+local function compile(in_ext, out_ext, flags)
+    compile_file(opts.source_file, opts.output, in_ext, out_ext, flags)
+end
+
+--
+-- Compiling to .so with the build cache
+--
+
+local function compile_with_cache(source_file, output, cache_dir, flags)
+    local so_name = output or (util.split_ext(source_file) .. ".so")
+    local d_pln_name = util.split_ext(so_name) .. ".d.pln"
+    local mod_name = string.gsub(util.split_ext(so_name), "/", "_")
+
+    -- The cache doesn't keep the header of the C API.
+    local key = not flags.emit_c_api and build_cache.key(source_file, mod_name, opts.O, flags)
+    if key and build_cache.fetch(cache_dir, key, so_name, d_pln_name) then
+        return
+    end
+
+    compile_file(source_file, output, "pln", "so", flags)
+
+    if key then
+        local ok, err = build_cache.store(cache_dir, key, so_name, d_pln_name)
+        if not ok then
+            io.stderr:write(compiler_name, ": warning: could not update the build cache: ",
+                tostring(err), "\n")
+        end
+    end
+end
+
+-- The command line for running this same compiler on a single file, in a separate process. The
+-- worker may run up to [njobs] C compilers of its own, if it splits the module into several units.
+local function worker_command(source_file, flags, cache_dir, njobs)
+    local parts = {}
+    local first = 0
+    while arg[first - 1] do first = first - 1 end
+    for i = first, 0 do
+        table.insert(parts, util.shell_quote(arg[i]))
+    end
+
+    table.insert(parts, "-O" .. tostring(opts.O))
+    table.insert(parts, "-j " .. tostring(njobs))
+    if flags.traceback_lite then
+        table.insert(parts, "--use-lite-traceback")
+    elseif flags.use_traceback then
+        table.insert(parts, "--use-traceback")
+    end
+    if flags.instrument then
+        table.insert(parts, "--instrument")
+    end
+    if flags.instrument_allocs then
+        table.insert(parts, "--instrument-allocs")
+    end
+    if flags.instrument_checks then
+        table.insert(parts, "--instrument-checks")
+    end
+    if flags.batch_entry_points then
+        table.insert(parts, "--batch-entry-points")
+    end
+    if flags.emit_c_api then
+        table.insert(parts, "--emit-c-api")
+    end
+    if flags.single_invocation then
+        table.insert(parts, "--pipe")
+    end
+    if flags.lto then
+        table.insert(parts, "--lto")
+    end
+    if flags.split_units > 1 then
+        table.insert(parts, "--split-units " .. tostring(flags.split_units))
+    end
+    if flags.pgo_generate then
+        table.insert(parts, util.shell_quote("--pgo-generate=" .. flags.pgo_generate))
+    end
+    if flags.pgo_use then
+        table.insert(parts, util.shell_quote("--pgo-use=" .. flags.pgo_use))
+    end
+    for _, name in ipairs(flags.disabled_pass_list) do
+        table.insert(parts, "-fno-" .. name)
+    end
+    if flags.timer then
+        table.insert(parts, "--time-passes")
+    end
+    if flags.verify_ir then
+        table.insert(parts, "--verify-ir")
+    end
+    if cache_dir then
+        table.insert(parts, "--cache-dir")
+        table.insert(parts, util.shell_quote(cache_dir))
+    end
+    table.insert(parts, util.shell_quote(source_file))
+    return table.concat(parts, " ")
+end
+
+-- Split the input files into batches that can be compiled in parallel. A module that requires
+-- another module from the command line must wait until that module's .d.pln file exists.
+local function compilation_batches(source_files)
+    local file_of_module = {}
+    for _, file in ipairs(source_files) do
+        file_of_module[util.split_ext(file)] = file
+    end
+
+    local deps = {}
+    for _, file in ipairs(source_files) do
+        deps[file] = {}
+        local input = util.get_file_contents(file)
+        -- If we can't parse the file now, the worker will report the error later.
+        local module_names = input and build_cache.required_modules(file, input) or {}
+        for _, module_name in ipairs(module_names) do
+            local dep = file_of_module[module_name]
+            if dep and dep ~= file then
+                table.insert(deps[file], dep)
+            end
+        end
+    end
+
+    local batches = {}
+    local done = {}
+    local remaining = source_files
+    while #remaining > 0 do
+        local batch, rest = {}, {}
+        for _, file in ipairs(remaining) do
+            local ready = true
+            for _, dep in ipairs(deps[file]) do
+                if not done[dep] then ready = false end
+            end
+            table.insert(ready and batch or rest, file)
+        end
+        if #batch == 0 then
+            -- Circular requires. Let the type checker complain about them.
+            batch, rest = rest, {}
+        end
+        for _, file in ipairs(batch) do
+            done[file] = true
+        end
+        table.insert(batches, batch)
+        remaining = rest
+    end
+    return batches
+end
+
+local function do_compile_many(flags, cache_dir)
+    if #opts.source_files == 1 then
+        compile_with_cache(opts.source_file, opts.output, cache_dir, flags)
+        return
+    end
+
+    if opts.output then
+        util.abort(compiler_name ..
+            ": the --output option can only be used with a single input file")
+    end
+
+    local njobs = opts.jobs or util.number_of_cpus()
+    if njobs < 1 then
+        util.abort(compiler_name .. ": the number of jobs must be positive")
+    end
+
+    for _, batch in ipairs(compilation_batches(opts.source_files)) do
+        -- Share the jobs between the workers, so that --split-units doesn't start more C compilers
+        -- than we asked for.
+        local worker_jobs = math.max(1, njobs // #batch)
+        local cmds = {}
+        for i, file in ipairs(batch) do
+            cmds[i] = worker_command(file, flags, cache_dir, worker_jobs)
+        end
+
+        local failed = false
+        for _, result in ipairs(util.execute_parallel(cmds, njobs)) do
+            io.stderr:write(result.output)
+            if not result.ok then failed = true end
+        end
+        if failed then
+            os.exit(1)
+        end
+    end
+end
+
+local function compile_up_to(stop_after, flags)
     local input, err = driver.load_input(opts.source_file)
     if err then util.abort(err) end
 
-    local out, errs = driver.compile_internal(opts.source_file, input, stop_after, opts.O)
+    local out, errs = driver.compile_internal(opts.source_file, input, stop_after, opts.O, flags)
     if not out then util.abort(table.concat(errs, "\n")) end
 
     return out
 end
 
-local function do_check()
-    compile_up_to("uninitialized")
+local function do_check(flags)
+    compile_up_to("uninitialized", flags)
 end
 
-local function do_print_ir(mode)
-    local module = compile_up_to("optimize")
+local function do_print_ir(flags, mode)
+    local module = compile_up_to("optimize", flags)
     io.stdout:write(print_ir(module, mode))
 end
 
-local function do_print_types()
-    local module = compile_up_to("typechecker")
+local function do_remarks(flags)
+    local module = compile_up_to("optimize", flags)
+    local mod_name = string.gsub(string.gsub(opts.source_file, "%.pln$", ""), "/", "_")
+    local remarks = coder.remarks(module, mod_name, opts.source_file, flags)
+    io.stdout:write(json.encode(remarks, "  "), "\n")
+end
+
+local function do_print_types(flags)
+    local module = compile_up_to("typechecker", flags)
 
     local d_pln_code
     d_pln_code = type_extractor.generate_type_declarations(module)
@@ -85,20 +318,97 @@ local function do_print_types()
     io.stdout:write(d_pln_code)
 end
 
+-- The instrumented module will write its profile to this directory. Since we don't know where the
+-- workload will run from, we need an absolute path.
+local function pgo_generate_dir()
+    local dir = opts.pgo_generate
+    if type(dir) == "table" then
+        dir = dir[1] or "pallene-profile"
+    end
+    local qdir = util.shell_quote(dir)
+    local ok, err, out =
+        util.outputs_of_execute("mkdir -p " .. qdir .. " && cd " .. qdir .. " && pwd")
+    if not ok then util.abort(err) end
+    return (string.gsub(out, "\n$", ""))
+end
+
+-- The -fno-<pass> options. We accept both dashes and underscores in the pass name.
+local function disabled_passes()
+    local list, set = {}, {}
+    for _, opt in ipairs(opts.f) do
+        local name = string.match(opt, "^no%-(.*)$")
+        name = name and string.gsub(name, "-", "_")
+        if not name or not pass_manager.is_optimization(name) then
+            util.abort(string.format("%s: unknown option -f%s. The optimization passes are: %s",
+                compiler_name, opt, table.concat(pass_manager.optimization_passes(), ", ")))
+        end
+        if not set[name] then
+            table.insert(list, name)
+            set[name] = true
+        end
+    end
+    table.sort(list)
+    return list, set
+end
+
 function pallenec.main()
+    local disabled_pass_list, disabled_pass_set = disabled_passes()
+
+    if opts.split_units and opts.split_units < 1 then
+        util.abort(compiler_name .. ": --split-units must be a positive integer")
+    end
+
+    -- The C API functions are not called through a Lua entry point, which is where the tracer
+    -- would get its frame from.
+    if opts.emit_c_api and (opts.use_traceback or opts.use_lite_traceback) then
+        util.abort(compiler_name .. ": --emit-c-api can't be used together with tracebacks")
+    end
+
     local flags = {
-        use_traceback = opts.use_traceback and true or false
+        use_traceback = (opts.use_traceback or opts.use_lite_traceback) and true or false,
+        traceback_lite = opts.use_lite_traceback and true or false,
+        instrument = opts.instrument and true or false,
+        instrument_allocs = opts.instrument_allocs and true or false,
+        instrument_checks = opts.instrument_checks and true or false,
+        batch_entry_points = opts.batch_entry_points and true or false,
+        emit_c_api = opts.emit_c_api and true or false,
+        single_invocation = opts.pipe and true or false,
+        lto = opts.lto and true or false,
+        split_units = opts.split_units or 1,
+        jobs = opts.jobs or false,
+        pgo_generate = opts.pgo_generate and pgo_generate_dir() or false,
+        pgo_use = opts.pgo_use or false,
+        disabled_pass_list = disabled_pass_list,
+        disabled_passes = disabled_pass_set,
+        timer = opts.time_passes and pass_manager.PassTimer.new() or false,
+        verify_ir = opts.verify_ir and true or false,
     }
 
-    if     opts.emit_c      then compile("pln", "c", flags)
+    local compiles_to_so = not (opts.emit_c or opts.emit_lua or opts.emit_types or opts.compile_c
+        or opts.only_check or opts.print_ir or opts.remarks or opts.print_types)
+    if #opts.source_files > 1 and not compiles_to_so then
+        util.abort(compiler_name .. ": multiple input files can only be compiled to .so")
+    end
+
+    local cache_dir = opts.cache_dir or build_cache.default_dir()
+    if cache_dir == "" then cache_dir = nil end
+
+    if compiles_to_so and (#opts.source_files > 1 or cache_dir) then
+        do_compile_many(flags, cache_dir)
+    elseif opts.emit_c      then compile("pln", "c", flags)
     elseif opts.emit_lua    then compile("pln", "lua", flags)
     elseif opts.emit_types  then compile("pln", "d.pln", flags)
     elseif opts.compile_c   then compile("c" ,  "so", flags)
-    elseif opts.only_check  then do_check()
-    elseif opts.print_ir    then do_print_ir()
-    elseif opts.print_types then do_print_types()
+    elseif opts.only_check  then do_check(flags)
+    elseif opts.print_ir    then do_print_ir(flags)
+    elseif opts.remarks     then do_remarks(flags)
+    elseif opts.print_types then do_print_types(flags)
     else --[[default]]           compile("pln", "so", flags)
     end
+
+    if flags.timer and #flags.timer.entries > 0 then
+        io.stderr:write(flags.timer:report())
+    end
 end
 
 return pallenec
@@ -34,6 +34,14 @@
 -- */
 
 return [==[
+/* clock_gettime is POSIX, not C99, so we must ask for it before including any system header. */
+#if defined(PALLENE_INSTRUMENT) || defined(PALLENE_INSTRUMENT_ALLOCS)
+#if !defined(_POSIX_C_SOURCE) || _POSIX_C_SOURCE < 199309L
+#undef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L
+#endif
+#endif
+
 #define LUA_CORE
 #include <lua.h>
 #include <lauxlib.h>
@@ -53,14 +61,13 @@ return [==[
 
 #define PALLENE_UNREACHABLE __builtin_unreachable()
 
+/* For the functions that raise runtime errors. The C compiler moves the code that calls them away
+ * from the hot code, and doesn't inline them. */
+#define PALLENE_COLD __attribute__((cold, noinline))
+
 /* PALLENE TRACER HELPER MACROS */
 
 #ifdef PT_DEBUG
-/* Prepares finalizer function for Lua interface calls. */
-#define PALLENE_PREPARE_FINALIZER()                              \
-    setobj(L, s2v(L->top.p++), &K->uv[1].uv);                    \
-    lua_toclose(L, -1)
-
 #define PALLENE_GET_FNSTACK()                                    \
     pt_fnstack_t *fnstack = pvalue(&K->uv[0].uv)
 
@@ -71,15 +78,64 @@ return [==[
     pt_frame_t _frame =                                          \
         PALLENE_TRACER_C_FRAME(_details)
 
+#ifdef PT_LITE
+/* The lite tracer (--use-lite-traceback) does not use a finalizer. Each Lua entry point pops its
+ * own frame when it returns, and remembers in the frame where its closure is in the Lua stack. If
+ * an error unwinds some entry points, their frames stay behind until the next entry point finds
+ * out that they are no longer active, and drops them. */
+#define PALLENE_PREPARE_FINALIZER()
+
+/* The frame's line is the stack position, encoded as a negative number. A Lua entry point only
+ * sets its own line if one of its argument checks fails, so a positive line means an error. */
+#define PALLENE_TRACER_LITE_STAMP(L, base)  (-(int)((base) - (L)->stack.p) - 1)
+
+static void pallene_tracer_lite_unwind(lua_State *L, pt_fnstack_t *fnstack, StackValue *base)
+{
+    int stamp = PALLENE_TRACER_LITE_STAMP(L, base);
+    int top = fnstack->count;
+    if (top > fnstack->capacity) top = fnstack->capacity;
+    for (int i = top - 1; i >= 0; i--) {
+        pt_frame_t *frame = &fnstack->stack[i];
+        if (frame->type != PALLENE_TRACER_FRAME_TYPE_LUA) continue;
+        if (frame->line < 0 && frame->line > stamp) {
+            /* Below us in the Lua stack. It is still active if its closure is still there. */
+            const TValue *v = s2v(L->stack.p + (-frame->line - 1));
+            if (ttisCclosure(v) && clCvalue(v)->f == frame->shared.c_fnptr) return;
+        }
+        fnstack->count = i;
+    }
+    fnstack->count = 0;
+}
+
+#define PALLENE_PREPARE_LUA_FRAME(fnptr)                         \
+    PALLENE_GET_FNSTACK();                                       \
+    pallene_tracer_lite_unwind(L, fnstack, base);                \
+    pt_frame_t _frame = {                                        \
+        .type = PALLENE_TRACER_FRAME_TYPE_LUA,                   \
+        .line = PALLENE_TRACER_LITE_STAMP(L, base),              \
+        .shared = { .c_fnptr = fnptr } }
+
+#define PALLENE_LUA_FRAMEEXIT()         PALLENE_TRACER_FRAMEEXIT(fnstack)
+#else
+/* Prepares finalizer function for Lua interface calls. */
+#define PALLENE_PREPARE_FINALIZER()                              \
+    setobj(L, s2v(L->top.p++), &K->uv[1].uv);                    \
+    lua_toclose(L, -1)
+
 #define PALLENE_PREPARE_LUA_FRAME(fnptr)                         \
     PALLENE_GET_FNSTACK();                                       \
     pt_frame_t _frame =                                          \
         PALLENE_TRACER_LUA_FRAME(fnptr)
 
+/* The finalizer pops the Lua frame. */
+#define PALLENE_LUA_FRAMEEXIT()
+#endif // PT_LITE
+
 #else
 #define PALLENE_PREPARE_FINALIZER()
 #define PALLENE_PREPARE_C_FRAME(name)
 #define PALLENE_PREPARE_LUA_FRAME(fnptr)
+#define PALLENE_LUA_FRAMEEXIT()
 #endif // PT_DEBUG
 
 #define PALLENE_C_FRAMEENTER(name)                               \
@@ -94,6 +150,83 @@ return [==[
 #define PALLENE_SETLINE(line)           PALLENE_TRACER_SETLINE(fnstack, line)
 #define PALLENE_FRAMEEXIT()             PALLENE_TRACER_FRAMEEXIT(fnstack)
 
+/* PALLENE INSTRUMENTATION (--instrument, --instrument-allocs and --instrument-checks) */
+
+#if defined(PALLENE_INSTRUMENT) || defined(PALLENE_INSTRUMENT_ALLOCS)
+#include <time.h>
+
+static inline unsigned long long pallene_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+#endif
+
+#ifdef PALLENE_INSTRUMENT
+/* The times are in nanoseconds. The module has an array `pallene_stats` with one of these for each
+ * function, and `pallene_stats_children` is the time spent in the callees of the running function.
+ * Calls that end with an error are neither counted nor timed. */
+typedef struct {
+    unsigned long long calls;         /* Calls to the Pallene entry point */
+    unsigned long long time;          /* Time in the Pallene entry point */
+    unsigned long long self_time;     /* ...minus the time in other functions of this module */
+    unsigned long long lua_calls;     /* Calls to the Lua entry point */
+    unsigned long long lua_time;      /* Time in the Lua entry point */
+    unsigned long long boundary_time; /* ...minus the time in the Pallene entry point */
+} pallene_stats_t;
+
+#define PALLENE_STATS_ENTER()                                    \
+    unsigned long long _stats_start = pallene_stats_now();       \
+    unsigned long long _stats_outer = pallene_stats_children;    \
+    pallene_stats_children = 0
+
+#define PALLENE_STATS_EXIT(calls, time, self_time)               \
+    do {                                                         \
+        unsigned long long _elapsed =                            \
+            pallene_stats_now() - _stats_start;                  \
+        calls++;                                                 \
+        time += _elapsed;                                        \
+        if (_elapsed > pallene_stats_children)                   \
+            self_time += _elapsed - pallene_stats_children;      \
+        pallene_stats_children = _stats_outer + _elapsed;        \
+    } while (0)
+#endif // PALLENE_INSTRUMENT
+
+#ifdef PALLENE_INSTRUMENT_ALLOCS
+/* The module has an array `pallene_alloc_sites`, with one of these for each kind of object that
+ * each line of each function allocates. The bytes are an estimate of what the Lua allocator is
+ * asked for, because short strings are interned and the hash part of a table is rounded up to a
+ * power of two. The GC time is the time spent in the incremental collector at the CheckGC that
+ * follows the allocation, in nanoseconds. */
+typedef struct {
+    unsigned long long count;    /* Objects allocated */
+    unsigned long long bytes;    /* Their size */
+    unsigned long long gc_steps; /* Collector steps run afterwards */
+    unsigned long long gc_time;  /* Time spent in those steps */
+} pallene_alloc_site_t;
+
+#define PALLENE_ALLOC_COUNT(site, nbytes)                        \
+    do {                                                         \
+        pallene_alloc_sites[site].count++;                       \
+        pallene_alloc_sites[site].bytes += (nbytes);             \
+    } while (0)
+
+/* For the `pos` argument of luaC_condGC. The `pre` argument reads the clock into `start`. */
+#define PALLENE_ALLOC_GC(site, start)                            \
+    do {                                                         \
+        pallene_alloc_sites[site].gc_steps++;                    \
+        pallene_alloc_sites[site].gc_time +=                     \
+            pallene_stats_now() - (start);                       \
+    } while (0)
+#endif // PALLENE_INSTRUMENT_ALLOCS
+
+#ifdef PALLENE_INSTRUMENT_CHECKS
+/* How many times each runtime check ran. We only know how many checks there are after generating
+ * all the functions, so the array is defined at the end of the main unit. */
+extern __attribute__((visibility("hidden"))) unsigned long long pallene_check_counts[];
+#endif
+
 /* Type tags */
 static const char *pallene_type_name(lua_State *L, const TValue *v);
 static int pallene_is_truthy(const TValue *v);
@@ -102,14 +235,26 @@ static int pallene_bvalue(TValue *obj);
 static void pallene_setbvalue(TValue *obj, int b);
 
 /* Runtime errors */
-static l_noret pallene_runtime_tag_check_error(lua_State *L, const char* file, int line,
+static PALLENE_COLD l_noret pallene_runtime_tag_check_error(lua_State *L, const char* file, int line,
                                 const char *expected_type_name, const TValue *received_type, const char *description_fmt, ...);
-static l_noret pallene_runtime_arity_error(lua_State *L, const char *name, int min_nargs, int max_nargs, int received);
-static l_noret pallene_runtime_divide_by_zero_error(lua_State *L, const char* file, int line);
-static l_noret pallene_runtime_mod_by_zero_error(lua_State *L, const char* file, int line);
-static l_noret pallene_runtime_number_to_integer_error(lua_State *L, const char* file, int line);
-static l_noret pallene_runtime_array_metatable_error(lua_State *L, const char* file, int line);
-static l_noret pallene_runtime_cant_grow_stack_error(lua_State *L);
+static PALLENE_COLD l_noret pallene_runtime_arity_error(lua_State *L, const char *name, int min_nargs, int max_nargs, int received);
+static PALLENE_COLD l_noret pallene_runtime_divide_by_zero_error(lua_State *L, const char* file, int line);
+static PALLENE_COLD l_noret pallene_runtime_mod_by_zero_error(lua_State *L, const char* file, int line);
+static PALLENE_COLD l_noret pallene_runtime_number_to_integer_error(lua_State *L, const char* file, int line);
+static PALLENE_COLD l_noret pallene_runtime_array_metatable_error(lua_State *L, const char* file, int line);
+static PALLENE_COLD l_noret pallene_runtime_cant_grow_stack_error(lua_State *L);
+static PALLENE_COLD void pallene_grow_stack(lua_State *L, int n);
+
+/* The tag checks in the generated code only pass a site number to the function that raises the
+ * error, so that they are just a comparison and a branch. The rest is in a table of these, which
+ * the compiler generates at the end of the module, together with the pallene_tag_check_failed
+ * function. See Coder:get_stack_slot. */
+typedef struct {
+    const char *file;
+    int line;
+    const char *expected_type;
+    const char *description;
+} pallene_tag_check_site_t;
 
 /* Arithmetic operators */
 static lua_Integer pallene_int_divi(lua_State *L, lua_Integer m, lua_Integer n, const char* file, int line);
@@ -266,6 +411,15 @@ static l_noret pallene_runtime_cant_grow_stack_error(lua_State *L)
     PALLENE_UNREACHABLE;
 }
 
+/* The slow path of the stack checks in the generated code, which only call this when the current
+ * CallInfo doesn't have enough free slots. See stack_checks.lua. */
+static PALLENE_COLD void pallene_grow_stack(lua_State *L, int n)
+{
+    if (!lua_checkstack(L, n)) {
+        pallene_runtime_cant_grow_stack_error(L);
+    }
+}
+
 /* Lua and Pallene round integer division towards negative infinity, while C rounds towards zero.
  * Here we inline luaV_div, to allow the C compiler to constant-propagate. For an explanation of the
  * algorithm, see the comments for luaV_div. */
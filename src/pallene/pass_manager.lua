@@ -0,0 +1,280 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- PASS MANAGER
+-- ============
+-- The compiler pipeline is a list of passes that run one after the other, in the order that they
+-- were registered. Each pass receives the output of the previous one (first the AST, then the IR)
+-- and returns its own output, or false and a list of error messages.
+--
+-- Optimization passes only run at -O1 and above, and they can also be disabled one by one, with
+-- `pallenec -fno-<pass>`. This helps when bisecting a performance regression or a miscompilation.
+--
+-- The pass manager can also measure how long each pass takes (`pallenec --time-passes`) and run
+-- the IR verifier after every pass that outputs IR (`pallenec --verify-ir`, or setting the
+-- PALLENE_DEBUG environment variable).
+
+local ir_verifier = require "pallene.ir_verifier"
+local util = require "pallene.util"
+
+local pass_manager = {}
+
+local passes = {}       -- list of passes, in execution order
+local pass_by_name = {} -- name => pass
+
+--
+-- @param name: Used by the stop_after parameter of driver.compile_internal, and by -fno-<name>.
+-- @param run: Function that receives the output of the previous pass.
+-- @param opts.optimization: Optimization passes can be disabled and don't run at -O0.
+-- @param opts.outputs_ir: If true, the IR verifier checks the output of the pass.
+--
+function pass_manager.register(name, run, opts)
+    assert(not pass_by_name[name], "duplicate pass name")
+    local pass = {
+        name = name,
+        run = run,
+        optimization = opts.optimization or false,
+        outputs_ir = opts.outputs_ir or false,
+    }
+    table.insert(passes, pass)
+    pass_by_name[name] = pass
+end
+
+function pass_manager.optimization_passes()
+    local names = {}
+    for _, pass in ipairs(passes) do
+        if pass.optimization then
+            table.insert(names, pass.name)
+        end
+    end
+    return names
+end
+
+function pass_manager.is_optimization(name)
+    local pass = pass_by_name[name]
+    return pass and pass.optimization or false
+end
+
+function pass_manager.debug_mode()
+    local env = os.getenv("PALLENE_DEBUG")
+    return env ~= nil and env ~= "" and env ~= "0"
+end
+
+--
+-- Timing
+--
+
+-- We want wall-clock time, but the Lua standard library only has os.clock (processor time) and
+-- os.time (seconds). Use the chronos library if it is installed, like benchlib does. Without it we
+-- can't measure the phases that run other programs, such as the C compiler, because os.clock only
+-- counts the time of this process.
+local get_time
+do
+    local ok, chronos = pcall(require, "chronos")
+    if ok then
+        get_time = chronos.nanotime
+        pass_manager.has_wall_clock = true
+    else
+        get_time = os.clock
+        pass_manager.has_wall_clock = false
+    end
+end
+
+-- How often we look at the memory usage, to find its peak.
+local PEAK_HOOK_INSTRUCTIONS = 1000
+
+local PassTimer = util.Class()
+pass_manager.PassTimer = PassTimer
+
+-- The measurements form a tree, because a pass can measure parts of itself. Each entry has a list
+-- of the measurements inside of it, in the order that they started.
+local function new_entry(name, external)
+    return {
+        name = name,
+        calls = 0,
+        seconds = 0,
+        kb_change = 0,
+        kb_peak = 0,
+        external = external,
+        children = {},      -- list of entries
+        child_by_name = {}, -- name => entry
+    }
+end
+
+function PassTimer:init()
+    self.root = new_entry("total", false)
+    self.entries = self.root.children -- the outermost measurements
+    self.current = self.root          -- the innermost running measurement
+    self.depth = 0                    -- how many measurements are running
+    self.kb_peak = 0                  -- peak memory usage of the innermost running measurement
+end
+
+-- Runs f(...) and records how long it took and how much memory it used. The garbage collector keeps
+-- running, so the time includes the collections that the pass caused. We report the change in
+-- memory usage from the start to the end of the pass, and the peak usage while it ran. The peak is
+-- sampled by a count hook, so it can miss short-lived spikes.
+-- If the same name is measured more than once inside of the same parent, the measurements are
+-- added up.
+function PassTimer:measure(name, f, ...)
+    return self:run_measurement(self.current, name, false, f, ...)
+end
+
+-- Like measure, for phases that spend their time in other processes, such as the C compiler.
+function PassTimer:measure_external(name, f, ...)
+    return self:run_measurement(self.current, name, true, f, ...)
+end
+
+-- Measures f(...) as a part of the outermost measurement called [parent_name], which has already
+-- finished. This is for breaking down the time of a pass after the fact, without adding the timing
+-- overhead to the pass itself. The time is not added to the time of the parent.
+function PassTimer:measure_in(parent_name, name, f, ...)
+    local parent = assert(self.root.child_by_name[parent_name], "unknown measurement")
+    return self:run_measurement(parent, name, false, f, ...)
+end
+
+function PassTimer:run_measurement(parent, name, external, f, ...)
+    local entry = parent.child_by_name[name]
+    if not entry then
+        entry = new_entry(name, external)
+        table.insert(parent.children, entry)
+        parent.child_by_name[name] = entry
+    end
+
+    local outer = self.current
+    self.current = entry
+
+    local kb_before = collectgarbage("count")
+    local outer_peak = self.kb_peak
+    self.kb_peak = kb_before
+
+    local old_hook, old_mask, old_count
+    if self.depth == 0 then
+        old_hook, old_mask, old_count = debug.gethook()
+        debug.sethook(function()
+            local kb = collectgarbage("count")
+            if kb > self.kb_peak then self.kb_peak = kb end
+        end, "", PEAK_HOOK_INSTRUCTIONS)
+    end
+    self.depth = self.depth + 1
+    local t_before = get_time()
+
+    local results = table.pack(f(...))
+
+    local t_after = get_time()
+    self.depth = self.depth - 1
+    if self.depth == 0 then
+        debug.sethook(old_hook, old_mask, old_count)
+    end
+    local kb_after = collectgarbage("count")
+    local kb_peak = math.max(self.kb_peak, kb_after)
+    self.kb_peak = math.max(outer_peak, kb_peak)
+    self.current = outer
+
+    entry.calls = entry.calls + 1
+    entry.seconds = entry.seconds + (t_after - t_before)
+    entry.kb_change = entry.kb_change + (kb_after - kb_before)
+    entry.kb_peak = math.max(entry.kb_peak, kb_peak)
+
+    return table.unpack(results, 1, results.n)
+end
+
+-- Nested measurements are indented under their parent, and are not counted in the total. Without a
+-- wall clock, the time of the external phases is unknown, so we leave it out.
+function PassTimer:report()
+    local lines = {}
+    local total_seconds, total_kb, peak_kb = 0, 0, 0
+    local has_unknown_times = false
+    table.insert(lines, string.format("%-30s %12s %14s %14s",
+        "pass", "time (ms)", "change (KiB)", "peak (KiB)"))
+
+    local function add_lines(entries, depth)
+        for _, e in ipairs(entries) do
+            local name = string.rep("  ", depth) .. e.name
+            if e.calls > 1 then
+                name = string.format("%s (x%d)", name, e.calls)
+            end
+            local known_time = pass_manager.has_wall_clock or not e.external
+            local time = known_time and string.format("%.3f", 1000 * e.seconds) or "n/a"
+            table.insert(lines, string.format("%-30s %12s %14.1f %14.1f",
+                name, time, e.kb_change, e.kb_peak))
+            if not known_time then
+                has_unknown_times = true
+            end
+            if depth == 0 then
+                if known_time then
+                    total_seconds = total_seconds + e.seconds
+                end
+                total_kb = total_kb + e.kb_change
+                peak_kb = math.max(peak_kb, e.kb_peak)
+            end
+            add_lines(e.children, depth + 1)
+        end
+    end
+    add_lines(self.entries, 0)
+
+    table.insert(lines, string.format("%-30s %12.3f %14.1f %14.1f",
+        "total", 1000 * total_seconds, total_kb, peak_kb))
+    if has_unknown_times then
+        table.insert(lines, "n/a: the time of other programs needs a wall clock (install chronos)")
+    end
+    table.insert(lines, "")
+    return table.concat(lines, "\n")
+end
+
+--
+-- Running the passes
+--
+
+--
+-- Runs the passes in order, starting with [input], and stopping after the pass named [stop_after].
+-- If [stop_after] is "optimize", run every pass.
+--
+-- @param options.disabled: Set of optimization passes that should not run.
+-- @param options.timer: A PassTimer, if we should measure the passes.
+-- @param options.verify_ir: Run the IR verifier after every pass that outputs IR.
+--
+function pass_manager.run(input, stop_after, opt_level, options)
+    local disabled = options.disabled or {}
+    local timer = options.timer
+    local verify_ir = options.verify_ir or pass_manager.debug_mode()
+
+    local data = input
+    for _, pass in ipairs(passes) do
+        local should_run = not pass.optimization or
+            ((opt_level or 0) > 0 and not disabled[pass.name])
+
+        if should_run then
+            local errs
+            if timer then
+                data, errs = timer:measure(pass.name, pass.run, data)
+            else
+                data, errs = pass.run(data)
+            end
+            if not data then
+                if type(errs) == "string" then errs = { errs } end
+                table.insert(errs, "compilation aborted due to previous error")
+                return false, errs
+            end
+
+            if verify_ir and pass.outputs_ir then
+                local ok, verifier_errs = ir_verifier.verify(data)
+                if not ok then
+                    table.insert(verifier_errs, 1, string.format(
+                        "internal error: invalid IR after the %s pass", pass.name))
+                    return false, verifier_errs
+                end
+            end
+        end
+
+        if stop_after == pass.name then
+            return data
+        end
+    end
+
+    if stop_after == "optimize" then return data end
+    error("impossible")
+end
+
+return pass_manager
@@ -0,0 +1,117 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- PROFILE GUIDED OPTIMIZATION
+-- ===========================
+-- The PGO workflow has three steps:
+--
+--   1) `pallenec --pgo-generate=DIR foo.pln` builds an instrumented foo.so.
+--   2) Run a representative workload that uses foo.so.
+--   3) `pallenec --pgo-use=DIR foo.pln` builds the optimized foo.so.
+--
+-- Most of the work is done by the C compiler, which we call with -fprofile-generate and
+-- -fprofile-use. But the C compiler can't see the structure of the Pallene IR, so we also keep our
+-- own profile with an execution count for each basic block, and for each ir.Cmd.JmpIf, how many
+-- times it jumped to its "true" target. The instrumented module keeps these counters in a static
+-- array and writes them to DIR/<modname>.pallene-profile when it is unloaded. Successive runs of
+-- the workload add up their counters.
+--
+-- The profile file is plain text. The first line has a hash of the shape of the IR (the number of
+-- blocks in each function) and the number of counters. Then, each line has one counter. Each basic
+-- block has two counters: how many times it was entered, and how many times its final JmpIf (if
+-- any) took the true branch.
+--
+-- The feedback is stored in the ir.Function, in the block_counts and true_counts fields. The coder
+-- uses it to add l_likely and l_unlikely to conditional jumps and to move cold blocks out of the
+-- way. For this to work, the IR must be the same in steps 1 and 3. Use the same -O level!
+
+local util = require "pallene.util"
+
+local pgo = {}
+
+function pgo.profile_file_name(dir, modname)
+    return dir .. "/" .. modname .. ".pallene-profile"
+end
+
+-- Where the counters of each function start in the counter array.
+-- Returns the list of offsets, the total number of counters and the hash of the IR shape.
+function pgo.counter_layout(module)
+    local offsets = {}
+    local shape = {}
+    local n = 0
+    for f_id, func in ipairs(module.functions) do
+        offsets[f_id] = n
+        n = n + 2 * #func.blocks
+        table.insert(shape, tostring(#func.blocks))
+    end
+    return offsets, n, util.hash_string(table.concat(shape, ","))
+end
+
+-- Index of the C array element that counts the entries to a block. The next element counts how
+-- many times the block's JmpIf took the true branch. Note that C arrays are 0-based.
+function pgo.block_counter(offsets, f_id, block_i)
+    return offsets[f_id] + 2 * (block_i - 1)
+end
+
+local function parse_profile(contents)
+    local lines = {}
+    for line in string.gmatch(contents, "[^\n]+") do
+        table.insert(lines, line)
+    end
+    local hash, n = string.match(lines[1] or "", "^pallene%-profile (%x+) (%d+)$")
+    if not hash then
+        return false
+    end
+    local counters = {}
+    for i = 2, #lines do
+        local count = math.tointeger(tonumber(lines[i]))
+        if not count then
+            return false
+        end
+        table.insert(counters, count)
+    end
+    if #counters ~= tonumber(n) then
+        return false
+    end
+    return hash, counters
+end
+
+--
+-- Loads the profile for [modname] from [dir] and stores the execution counts in the functions of
+-- [module]. Returns false and an error message if the profile is missing or doesn't match.
+--
+function pgo.apply_profile(module, dir, modname)
+    local file_name = pgo.profile_file_name(dir, modname)
+    local contents = util.get_file_contents(file_name)
+    if not contents then
+        return false, { string.format("could not read profile %s", file_name) }
+    end
+
+    local offsets, n, shape_hash = pgo.counter_layout(module)
+    local hash, counters = parse_profile(contents)
+    if not hash then
+        return false, { string.format("profile %s is corrupted", file_name) }
+    end
+    if hash ~= shape_hash or #counters ~= n then
+        return false, { string.format(
+            "profile %s does not match the program. "..
+            "Was it generated from a different version of the source code, or with another -O?",
+            file_name) }
+    end
+
+    for f_id, func in ipairs(module.functions) do
+        func.block_counts = {}
+        func.true_counts = {}
+        for block_i = 1, #func.blocks do
+            local k = pgo.block_counter(offsets, f_id, block_i)
+            func.block_counts[block_i] = counters[k + 1]
+            func.true_counts[block_i]  = counters[k + 2]
+        end
+    end
+
+    return module, {}
+end
+
+return pgo
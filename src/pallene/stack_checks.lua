@@ -0,0 +1,104 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- STACK CHECKS
+-- ============
+-- A Pallene function needs free space in the Lua stack, for its GC slots and for the arguments of
+-- the Lua functions that it calls. If every function checked for that in its prologue, a deep
+-- recursion such as the one in benchmarks/binarytrees would call lua_checkstack on every call.
+--
+-- Instead, we check once in the Lua entry point, for the most stack that the function might need
+-- including the functions that it calls statically (ir.Cmd.CallStatic). A Pallene-to-Pallene call
+-- then doesn't need a check, because the caller's check already covered the callee's frame.
+--
+-- The exception is recursion, because we can't bound how deep it will go. The functions that are
+-- part of a cycle in the static call graph still check in their prologue, and that check covers the
+-- non-recursive functions that they call. It is a comparison against the top of the current
+-- CallInfo, and only calls lua_checkstack when the stack actually has to grow. See
+-- Coder:stack_slots_needed and pallene_grow_stack.
+
+local ir = require "pallene.ir"
+
+local stack_checks = {}
+
+-- The functions called by each function, without repetitions.
+function stack_checks.static_callees(module)
+    local callees = {} -- { f_id => { f_id } }
+    for f_id, func in ipairs(module.functions) do
+        local seen = {}
+        callees[f_id] = {}
+        for _, block in ipairs(func.blocks) do
+            for _, cmd in ipairs(block.cmds) do
+                if cmd._tag == "ir.Cmd.CallStatic" then
+                    local callee = ir.static_callee(func, cmd)
+                    if callee and not seen[callee] then
+                        seen[callee] = true
+                        table.insert(callees[f_id], callee)
+                    end
+                end
+            end
+        end
+    end
+    return callees
+end
+
+-- The functions that may call themselves, directly or through other functions. They are the ones
+-- in a strongly connected component with more than one function, or with a self loop. We find the
+-- components with Tarjan's algorithm.
+function stack_checks.recursive_functions(callees)
+    local is_recursive = {} -- { f_id => boolean }
+    local index = {}        -- { f_id => integer }
+    local lowlink = {}      -- { f_id => integer }
+    local on_stack = {}     -- { f_id => boolean }
+    local stack = {}        -- { f_id }
+    local next_index = 1
+
+    local function visit(f_id)
+        index[f_id] = next_index
+        lowlink[f_id] = next_index
+        next_index = next_index + 1
+        table.insert(stack, f_id)
+        on_stack[f_id] = true
+
+        for _, g_id in ipairs(callees[f_id]) do
+            if not index[g_id] then
+                visit(g_id)
+                lowlink[f_id] = math.min(lowlink[f_id], lowlink[g_id])
+            elseif on_stack[g_id] then
+                lowlink[f_id] = math.min(lowlink[f_id], index[g_id])
+            end
+        end
+
+        if lowlink[f_id] == index[f_id] then
+            local component = {}
+            repeat
+                local g_id = table.remove(stack)
+                on_stack[g_id] = false
+                table.insert(component, g_id)
+            until g_id == f_id
+            for _, g_id in ipairs(component) do
+                is_recursive[g_id] = (#component > 1)
+            end
+        end
+    end
+
+    for f_id = 1, #callees do
+        if not index[f_id] then
+            visit(f_id)
+        end
+    end
+
+    for f_id = 1, #callees do
+        for _, g_id in ipairs(callees[f_id]) do
+            if g_id == f_id then
+                is_recursive[f_id] = true
+            end
+        end
+    end
+
+    return is_recursive
+end
+
+return stack_checks
@@ -0,0 +1,147 @@
+-- Copyright (c) 2026, The Pallene Developers
+-- Pallene is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- SPLITTING A MODULE INTO TRANSLATION UNITS
+-- =========================================
+-- A big Pallene module becomes a big C file, and the C compiler compiles a single file using a
+-- single CPU core. With `pallenec --split-units N`, the coder distributes the functions over N
+-- C files, so that they can be compiled in parallel. See Coder:generate_units.
+--
+-- The price is that the C compiler can't inline a function that is defined in another unit. To
+-- keep that from hurting, we try to place functions that call each other in the same unit: first we
+-- find the connected components of the static call graph, and only split a component if it alone
+-- is larger than the size of a unit. In that case we cut it in depth-first order, which tends to
+-- keep callers and callees together.
+--
+-- The size of a function is estimated by the number of IR commands in it.
+
+local ir = require "pallene.ir"
+
+local translation_units = {}
+
+local function function_size(func)
+    local n = 1
+    for _, block in ipairs(func.blocks) do
+        n = n + #block.cmds
+    end
+    return n
+end
+
+-- Undirected graph, with an edge between two functions if one of them statically calls the other.
+local function call_graph(module)
+    local neighbors = {} -- { f_id => { f_id } }
+    for f_id = 1, #module.functions do
+        neighbors[f_id] = {}
+    end
+    for f_id, func in ipairs(module.functions) do
+        for _, block in ipairs(func.blocks) do
+            for _, cmd in ipairs(block.cmds) do
+                if cmd._tag == "ir.Cmd.CallStatic" then
+                    local callee = ir.static_callee(func, cmd)
+                    if callee and callee ~= f_id then
+                        table.insert(neighbors[f_id], callee)
+                        table.insert(neighbors[callee], f_id)
+                    end
+                end
+            end
+        end
+    end
+    return neighbors
+end
+
+-- Returns the list of connected components, each one as a list of f_ids in depth-first order.
+local function connected_components(module)
+    local neighbors = call_graph(module)
+    local visited = {}
+    local components = {}
+    for root = 1, #module.functions do
+        if not visited[root] then
+            local component = {}
+            local stack = { root }
+            while #stack > 0 do
+                local f_id = table.remove(stack)
+                if not visited[f_id] then
+                    visited[f_id] = true
+                    table.insert(component, f_id)
+                    local ns = neighbors[f_id]
+                    for i = #ns, 1, -1 do
+                        if not visited[ns[i]] then
+                            table.insert(stack, ns[i])
+                        end
+                    end
+                end
+            end
+            table.insert(components, component)
+        end
+    end
+    return components
+end
+
+--
+-- Assigns each function to one of [n_units] translation units.
+-- Returns a list with the f_ids of each unit, sorted. Empty units are omitted, so there may be
+-- fewer than [n_units] of them.
+--
+function translation_units.partition(module, n_units)
+    assert(n_units >= 1)
+
+    local size = {}
+    local total = 0
+    for f_id, func in ipairs(module.functions) do
+        size[f_id] = function_size(func)
+        total = total + size[f_id]
+    end
+    local max_cluster_size = math.ceil(total / n_units)
+
+    -- 1) Group the functions into clusters that should stay together.
+    local clusters = {} -- list of { f_ids = {f_id}, size = integer }
+    for _, component in ipairs(connected_components(module)) do
+        local cluster = { f_ids = {}, size = 0 }
+        for _, f_id in ipairs(component) do
+            if cluster.size > 0 and cluster.size + size[f_id] > max_cluster_size then
+                table.insert(clusters, cluster)
+                cluster = { f_ids = {}, size = 0 }
+            end
+            table.insert(cluster.f_ids, f_id)
+            cluster.size = cluster.size + size[f_id]
+        end
+        table.insert(clusters, cluster)
+    end
+
+    -- 2) Distribute the clusters, largest first, always to the unit that is currently the smallest.
+    -- The sort is made stable by the first f_id, so that the output is deterministic.
+    table.sort(clusters, function(a, b)
+        if a.size ~= b.size then return a.size > b.size end
+        return a.f_ids[1] < b.f_ids[1]
+    end)
+
+    local units = {}
+    for i = 1, n_units do
+        units[i] = { f_ids = {}, size = 0 }
+    end
+    for _, cluster in ipairs(clusters) do
+        local smallest = units[1]
+        for i = 2, n_units do
+            if units[i].size < smallest.size then
+                smallest = units[i]
+            end
+        end
+        for _, f_id in ipairs(cluster.f_ids) do
+            table.insert(smallest.f_ids, f_id)
+        end
+        smallest.size = smallest.size + cluster.size
+    end
+
+    local result = {}
+    for _, unit in ipairs(units) do
+        if #unit.f_ids > 0 then
+            table.sort(unit.f_ids)
+            table.insert(result, unit.f_ids)
+        end
+    end
+    return result
+end
+
+return translation_units
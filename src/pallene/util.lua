@@ -109,6 +109,80 @@ function util.outputs_of_execute(cmd)
     return ok, err, out_content, err_content
 end
 
+-- Runs the shell commands in [cmds], with at most [njobs] of them running at the same time.
+-- Returns a list with one { ok = boolean, output = string } entry per command, in the same order
+-- as [cmds]. The output contains both the stdout and the stderr of the command.
+--
+-- Lua can only wait for a specific child process, so the scheduling is done by a shell script. It
+-- keeps one token per free job slot in a named pipe, and a new command starts as soon as any of the
+-- running ones gives its token back. The script prints the exit status of each command as it ends.
+function util.execute_parallel(cmds, njobs)
+    local results = {}
+    if #cmds == 0 then
+        return results
+    end
+
+    local dir = os.tmpname()
+    os.remove(dir)
+    assert(util.execute("mkdir " .. util.shell_quote(dir)))
+
+    local slots = util.shell_quote(dir .. "/slots")
+    local script = {
+        "mkfifo " .. slots .. " || exit 1",
+        "exec 3<>" .. slots,
+    }
+    for _ = 1, math.min(njobs, #cmds) do
+        table.insert(script, "echo >&3")
+    end
+    for i, cmd in ipairs(cmds) do
+        local prefix = string.format("%s/%d", dir, i)
+        assert(util.set_file_contents(prefix .. ".sh", cmd .. "\n"))
+        table.insert(script, string.format(
+            [[read slot <&3; { sh %s > %s 2>&1; echo "%d $?"; echo >&3; } &]],
+            util.shell_quote(prefix .. ".sh"), util.shell_quote(prefix .. ".out"), i))
+    end
+    table.insert(script, "wait")
+    assert(util.set_file_contents(dir .. "/run.sh", table.concat(script, "\n") .. "\n"))
+
+    local status = {} -- { integer => integer }
+    local handle = assert(io.popen("sh " .. util.shell_quote(dir .. "/run.sh"), "r"))
+    for line in handle:lines() do
+        local i, code = string.match(line, "^(%d+) (%d+)$")
+        if i then
+            status[math.tointeger(tonumber(i))] = math.tointeger(tonumber(code))
+        end
+    end
+    handle:close()
+
+    for i = 1, #cmds do
+        local output = util.get_file_contents(string.format("%s/%d.out", dir, i))
+        results[i] = { ok = (status[i] == 0), output = output or "" }
+    end
+    util.execute("rm -rf " .. util.shell_quote(dir))
+
+    return results
+end
+
+-- The number of CPUs that are online, or 1 if we can't find out.
+function util.number_of_cpus()
+    local ok, _, out = util.outputs_of_execute("getconf _NPROCESSORS_ONLN")
+    return ok and math.tointeger(tonumber(out)) or 1
+end
+
+--
+-- Hashing
+--
+
+-- 64-bit FNV-1a hash of a string, as 16 hex digits. This is not a cryptographic hash; it is only
+-- meant for things like cache keys.
+function util.hash_string(s)
+    local h = 0xcbf29ce484222325
+    for i = 1, #s do
+        h = (h ~ string.byte(s, i)) * 0x100000001b3
+    end
+    return string.format("%016x", h)
+end
+
 --
 -- OOP
 --
@@ -126,6 +200,25 @@ function util.Class()
     return cls
 end
 
+-- An in-memory output stream, with the same write method as a file handle.
+local StringBuffer = util.Class()
+util.StringBuffer = StringBuffer
+
+function StringBuffer:init()
+    self.parts = {}
+end
+
+function StringBuffer:write(...)
+    for i = 1, select("#", ...) do
+        table.insert(self.parts, (select(i, ...)))
+    end
+    return self
+end
+
+function StringBuffer:tostring()
+    return table.concat(self.parts)
+end
+
 --
 -- General purpose utilities
 --